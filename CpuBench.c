@@ -0,0 +1,397 @@
+#ifdef ISC_LOOPBACK
+
+/* End to end benchmark over the loopback backend:
+ * IscSendMessageEx -> write task -> IscWrite -> IscSRead -> read task -> callback
+ * for every id with a write and a read channel. Build with ISC_LOOPBACK and
+ * link without the shared memory driver.
+ *
+ *   -n count    messages per id (100000)
+ *   -s bytes    payload size, at least the bench header (64)
+ *   -l us       loopback latency (0)
+ *   -c count    loopback capacity per id (ISC_LOOPBACK_CAPACITY)
+ *   -e n        every nth IscWrite fails with ISC_ERR_NOMEM (0)
+ *   -r loops    run in reactor mode with that many loops (thread per task)
+ *   -p          no readable notification, read tasks poll
+ *   -b count    batch receive callback, up to count messages per call (off)
+ *   -z          loaned buffer receive callback
+ *   -w workers  run the callbacks on that many dispatch workers (off)
+ *   -t          message trace on: every message goes through the trace ring,
+ *               drained in the background (compare with and without)
+ *   -v rounds   instead of messages, time IscEventSet/IscEventWait: a set
+ *               then wait on one thread, and a ping-pong between two
+ *               (build with ISC_NO_FUTEX for the condvar events)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "isc.h"
+#include "CpuExt.h"
+#include "private.h"
+#include "CpuThread.h"
+#include "CpuChannel.h"
+#include "CpuReactor.h"
+#include "CpuStats.h"
+#include "CpuLoopback.h"
+#include "CpuDispatch.h"
+#include "CpuTrace.h"
+
+#define ISC_BENCH_DONE_MS   30000   /*give up waiting for the readers after*/
+#define ISC_BENCH_EVENT     0x00000001
+
+
+typedef struct
+{
+    uint8 id;
+    uint32 seq;
+    uint64_t sendNs;
+}IscBenchHeader;
+
+typedef struct
+{
+    uint32 received;
+    uint32 nextSeq;
+    uint32 outOfOrder;
+    IscHistogram latency;
+}IscBenchChannel;
+
+typedef struct
+{
+    IscEventHandle ping;
+    IscEventHandle pong;
+    uint32 rounds;
+}IscBenchEvents;
+
+static IscBenchChannel benchChannel[ISC_MAX_CHANNELS];
+static IscHistogram benchTotal;
+
+static void IscBenchReceived(uint8 *buf, uint16 len)
+{
+    IscBenchHeader hdr;
+    IscBenchChannel *ch;
+    uint64_t latencyNs;
+
+    if (len < sizeof(IscBenchHeader)) {
+        return;
+    }
+    memcpy(&hdr, buf, sizeof(IscBenchHeader));
+    if (hdr.id >= ISC_MAX_CHANNELS) {
+        return;
+    }
+
+    ch = &(benchChannel[hdr.id]);
+    latencyNs = IscTimeNowNs() - hdr.sendNs;
+    if (hdr.seq != ch->nextSeq) {
+        ch->outOfOrder++;
+    }
+    ch->nextSeq = hdr.seq + 1;
+    IscHistRecord(&(ch->latency), latencyNs);
+    IscHistRecord(&benchTotal, latencyNs);
+    __atomic_fetch_add(&(ch->received), 1, __ATOMIC_RELEASE);
+}
+
+static void IscBenchReceivedBatch(const ISC_READ_MSG_T *msgs, uint16 count)
+{
+    uint16 i;
+
+    for (i = 0; i < count; i++) {
+        IscBenchReceived(msgs[i].message, msgs[i].length);
+    }
+}
+
+/* the batch and buffer callbacks of ISC_MIX_ID see the mix_id byte */
+static void IscBenchReceivedMixBatch(const ISC_READ_MSG_T *msgs, uint16 count)
+{
+    uint16 i;
+
+    for (i = 0; i < count; i++) {
+        if (msgs[i].length != 0) {
+            IscBenchReceived(msgs[i].message + 1, msgs[i].length - 1);
+        }
+    }
+}
+
+static void IscBenchReceivedBuf(IscBuffer *buf)
+{
+    if (buf->id != ISC_MIX_ID) {
+        IscBenchReceived(buf->data, buf->length);
+    }
+    else if (buf->length != 0) {
+        IscBenchReceived(buf->data + 1, buf->length - 1);
+    }
+}
+
+static void IscBenchPonger(void *data)
+{
+    IscBenchEvents *ev = (IscBenchEvents *) data;
+    uint32 eventBits;
+    uint32 i;
+
+    for (i = 0; i < ev->rounds; i++) {
+        (void) IscEventWait(&(ev->ping), ISC_EVENT_WAIT_INFINITE, &eventBits);
+        (void) IscEventSet(&(ev->pong), ISC_BENCH_EVENT);
+    }
+}
+
+static int IscBenchEvent(uint32 rounds)
+{
+    IscBenchEvents ev;
+    IscThreadHandle thread;
+    uint64_t pairNs;
+    uint64_t tripNs;
+    uint32 eventBits;
+    uint32 i;
+
+    if ((IscEventCreate(&(ev.ping)) != ISC_RESULT_SUCCESS) ||
+        (IscEventCreate(&(ev.pong)) != ISC_RESULT_SUCCESS)) {
+        fprintf(stderr, "event create failed\n");
+        return 1;
+    }
+    ev.rounds = rounds;
+
+    /* uncontended: the bit is always pending, the wait never sleeps */
+    pairNs = IscTimeNowNs();
+    for (i = 0; i < rounds; i++) {
+        (void) IscEventSet(&(ev.pong), ISC_BENCH_EVENT);
+        (void) IscEventWait(&(ev.pong), ISC_EVENT_WAIT_INFINITE, &eventBits);
+    }
+    pairNs = IscTimeNowNs() - pairNs;
+
+    if (IscThreadCreateEx(IscBenchPonger, &ev, ISC_DEFAULT_STACK_SIZE, ISC_THREAD_PRIORITY_NORMAL,
+                          0, "IscBenchPong", &thread) != ISC_RESULT_SUCCESS) {
+        fprintf(stderr, "thread create failed\n");
+        return 1;
+    }
+    tripNs = IscTimeNowNs();
+    for (i = 0; i < rounds; i++) {
+        (void) IscEventSet(&(ev.ping), ISC_BENCH_EVENT);
+        (void) IscEventWait(&(ev.pong), ISC_EVENT_WAIT_INFINITE, &eventBits);
+    }
+    tripNs = IscTimeNowNs() - tripNs;
+    (void) IscThreadJoin(&thread);
+
+#ifdef ISC_EVENT_FUTEX
+    printf("futex events, %u rounds\n", rounds);
+#else
+    printf("condvar events, %u rounds\n", rounds);
+#endif
+    printf("set then wait  %8.1f ns\n", (double) pairNs / rounds);
+    printf("ping-pong      %8.1f ns per round trip\n", (double) tripNs / rounds);
+
+    IscEventDestroy(&(ev.ping));
+    IscEventDestroy(&(ev.pong));
+    return 0;
+}
+
+static uint64_t IscBenchCpuNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void IscBenchReport(const char *name, const IscHistogram *hist, uint64_t msgs,
+                           uint32 size, uint64_t wallNs)
+{
+    double seconds = (double) wallNs / 1e9;
+
+    printf("%-6s %9llu msgs %10.0f msg/s %8.2f MB/s  p50 %7.1f p99 %7.1f p999 %7.1f max %7.1f us\n",
+           name, (unsigned long long) msgs, (double) msgs / seconds,
+           (double) msgs * size / seconds / 1e6,
+           IscHistPercentile(hist, 500) / 1e3, IscHistPercentile(hist, 990) / 1e3,
+           IscHistPercentile(hist, 999) / 1e3, hist->maxNs / 1e3);
+}
+
+int main(int argc, char **argv)
+{
+    ISC_LOOPBACK_CONFIG_T loop = {0, 0, 0, 1};
+    ISC_SEND_OPTIONS_T opt = {ISC_SEND_BLOCK, ISC_SEND_WAIT_INFINITE, ISC_PRIO_NORMAL};
+    uint8 ids[ISC_MAX_CHANNELS];
+    uint8 idCount = 0;
+    uint32 count = 100000;
+    uint32 size = 64;
+    uint32 loops = 0;
+    uint32 batchMsgs = 0;
+    uint8 loaned = 0;
+    uint32 workers = 0;
+    uint8 trace = 0;
+    uint32 eventRounds = 0;
+    uint8 *payload;
+    uint64_t wallNs;
+    uint64_t cpuNs;
+    uint64_t sent;
+    uint32 i;
+    uint8 k;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:s:l:c:e:r:pb:zw:tv:")) != -1) {
+        switch (c) {
+        case 'n': count = (uint32) strtoul(optarg, NULL, 0); break;
+        case 's': size = (uint32) strtoul(optarg, NULL, 0); break;
+        case 'l': loop.latencyUs = (uint32) strtoul(optarg, NULL, 0); break;
+        case 'c': loop.capacity = (uint32) strtoul(optarg, NULL, 0); break;
+        case 'e': loop.nomemEvery = (uint32) strtoul(optarg, NULL, 0); break;
+        case 'r': loops = (uint32) strtoul(optarg, NULL, 0); break;
+        case 'p': loop.notify = 0; break;
+        case 'b': batchMsgs = (uint32) strtoul(optarg, NULL, 0); break;
+        case 'z': loaned = 1; break;
+        case 'w': workers = (uint32) strtoul(optarg, NULL, 0); break;
+        case 't': trace = 1; break;
+        case 'v': eventRounds = (uint32) strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: %s [-n count] [-s bytes] [-l us] [-c count] [-e n] [-r loops] [-p] [-b count] [-z] [-w workers] [-t] [-v rounds]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (eventRounds != 0) {
+        return IscBenchEvent(eventRounds);
+    }
+    if (size < sizeof(IscBenchHeader)) {
+        size = sizeof(IscBenchHeader);
+    }
+    if (size > 0xFFFF - 1) {
+        size = 0xFFFF - 1;
+    }
+
+    if (IscLoopbackInit(&loop) != ISC_RESULT_SUCCESS) {
+        fprintf(stderr, "loopback init failed\n");
+        return 1;
+    }
+    if ((loops != 0) &&
+        (IscSetThreadMode(ISC_THREAD_MODE_REACTOR, (uint8) loops) != ISC_RESULT_SUCCESS)) {
+        fprintf(stderr, "reactor mode failed\n");
+        return 1;
+    }
+    if (trace) {
+        IscSetMsgTrace(1);
+        if (IscTraceStart(0) != ISC_RESULT_SUCCESS) {
+            fprintf(stderr, "trace start failed\n");
+            return 1;
+        }
+    }
+    if ((workers != 0) && (IscDispatchStart((uint8) workers) != ISC_RESULT_SUCCESS)) {
+        fprintf(stderr, "dispatch start failed\n");
+        return 1;
+    }
+    for (k = 0; k < ISC_MAX_CHANNELS; k++) {
+        if ((ChannelMatrix[k][ISC_WR_TASK].ch == INVALID_CHANNEL) ||
+            (ChannelMatrix[k][ISC_RD_TASK].ch == INVALID_CHANNEL)) {
+            continue;
+        }
+        IscRegisterCb(k, IscBenchReceived);
+        if (workers != 0) {
+            IscSetDispatchMode(k, ISC_DISPATCH_CHANNEL);
+        }
+        if (loaned) {
+            IscRegisterBufCb(k, IscBenchReceivedBuf);
+        }
+        if (batchMsgs != 0) {
+            IscRegisterBatchCb(k, (k == ISC_MIX_ID) ? IscBenchReceivedMixBatch : IscBenchReceivedBatch,
+                               (uint16) batchMsgs, 0);
+        }
+        if (IscThreadInit(k, ISC_WR_TASK) != ISC_SUCCESS) {
+            fprintf(stderr, "id %d init failed\n", k);
+            continue;
+        }
+        ids[idCount++] = k;
+    }
+    payload = (uint8 *) malloc(size);
+    if ((payload == NULL) || (idCount == 0)) {
+        return 1;
+    }
+    memset(payload, 0x5A, size);
+    IscThreadSleep(10);
+
+    wallNs = IscTimeNowNs();
+    cpuNs = IscBenchCpuNs();
+    for (i = 0; i < count; i++) {
+        for (k = 0; k < idCount; k++) {
+            IscBenchHeader hdr = {ids[k], i, IscTimeNowNs()};
+
+            memcpy(payload, &hdr, sizeof(IscBenchHeader));
+            if (IscSendMessageEx(ids[k], 0, payload, (uint16) size, &opt) != ISC_SUCCESS) {
+                fprintf(stderr, "id %d send %u failed\n", ids[k], i);
+            }
+        }
+    }
+    for (i = 0; i < ISC_BENCH_DONE_MS; i++) {
+        for (k = 0; k < idCount; k++) {
+            if (__atomic_load_n(&(benchChannel[ids[k]].received), __ATOMIC_ACQUIRE) < count) {
+                break;
+            }
+        }
+        if (k == idCount) {
+            break;
+        }
+        IscThreadSleep(1);
+    }
+    wallNs = IscTimeNowNs() - wallNs;
+    cpuNs = IscBenchCpuNs() - cpuNs;
+
+    printf("%u ids, %u msgs of %u bytes each, latency %u us, capacity %u, nomem every %u, %s%s%s\n",
+           idCount, count, size, loop.latencyUs, loop.capacity, loop.nomemEvery,
+           (loops != 0) ? "reactor" : "thread per task", loop.notify ? "" : ", polling",
+           trace ? ", trace" : "");
+    sent = 0;
+    for (k = 0; k < idCount; k++) {
+        IscBenchChannel *ch = &(benchChannel[ids[k]]);
+        IscStats *stats = (IscStats *) malloc(sizeof(IscStats));
+        char name[8];
+
+        snprintf(name, sizeof(name), "id %d", ids[k]);
+        IscBenchReport(name, &(ch->latency), ch->received, size, wallNs);
+        if ((stats != NULL) && (IscGetStats(ids[k], stats) == ISC_RESULT_SUCCESS)) {
+            printf("       writes %u retries %u queue high %u, lost %u out of order %u\n",
+                   stats->writes, stats->retries, stats->queueHighWater,
+                   count - ch->received, ch->outOfOrder);
+            printf("       writer wakeups %u, %u found no work\n",
+                   stats->wakeups, stats->idleWakeups);
+            if (stats->dispatchLatency.count != 0) {
+                printf("       dispatch p50 %.1f p99 %.1f max %.1f us, %u stalls\n",
+                       IscHistPercentile(&(stats->dispatchLatency), 500) / 1e3,
+                       IscHistPercentile(&(stats->dispatchLatency), 990) / 1e3,
+                       stats->dispatchLatency.maxNs / 1e3, stats->dispatchStalls);
+            }
+        }
+        free(stats);
+        sent += ch->received;
+    }
+    IscBenchReport("all", &benchTotal, sent, size, wallNs);
+    printf("cpu %.1f ms, %.0f ns per message, loopback nomem %u\n",
+           cpuNs / 1e6, (sent != 0) ? (double) cpuNs / sent : 0.0, IscLoopbackNomemCount());
+
+    /* restart every id once, IscThreadDeinit returns after the tasks are gone */
+    wallNs = 0;
+    for (k = 0; k < idCount; k++) {
+        uint64_t startNs = IscTimeNowNs();
+
+        IscThreadDeinit(ids[k]);
+        if (IscThreadInit(ids[k], ISC_WR_TASK) != ISC_SUCCESS) {
+            fprintf(stderr, "id %d restart failed\n", ids[k]);
+        }
+        startNs = IscTimeNowNs() - startNs;
+        if (startNs > wallNs) {
+            wallNs = startNs;
+        }
+    }
+    printf("restart max %.1f us\n", wallNs / 1e3);
+
+    for (k = 0; k < idCount; k++) {
+        IscThreadDeinit(ids[k]);
+    }
+    IscDispatchStop();
+    if (trace) {
+        IscTraceStop();
+        (void) IscTraceDump();
+    }
+    IscLoopbackDeinit();
+    free(payload);
+    return 0;
+}
+
+#endif /*ISC_LOOPBACK*/
@@ -0,0 +1,38 @@
+#!/bin/sh
+# Loopback smoke test: run CpuBench in each mode and fail if any id lost or
+# reordered a message, or if an id did not come back after the restart.
+#
+#   CpuBenchCheck.sh [path to CpuBench] [messages per id]
+
+BENCH=${1:-./CpuBench}
+COUNT=${2:-20000}
+OUT=${TMPDIR:-/tmp}/CpuBenchCheck.$$
+rc=0
+
+trap 'rm -f "$OUT.out" "$OUT.err"' EXIT
+
+for mode in "" "-r 2" "-z" "-b 16" "-e 7" "-w 2"; do
+    name=${mode:-thread}
+    "$BENCH" -n "$COUNT" $mode > "$OUT.out" 2> "$OUT.err"
+    status=$?
+    if [ $status -ne 0 ]; then
+        echo "FAIL $name: exit code $status"
+        rc=1
+        continue
+    fi
+    ids=$(grep -a -o '^[0-9]* ids,' "$OUT.out" | cut -d' ' -f1)
+    clean=$(grep -a -c 'lost 0 out of order 0$' "$OUT.out")
+    if [ -z "$ids" ] || [ "$ids" -eq 0 ] || [ "$clean" -ne "$ids" ]; then
+        echo "FAIL $name: $clean of ${ids:-0} ids without loss or reordering"
+        grep -a 'lost' "$OUT.out" | grep -a -v 'lost 0 out of order 0$'
+        rc=1
+        continue
+    fi
+    if ! grep -a -q '^restart max' "$OUT.out" || grep -a -q 'restart failed' "$OUT.err"; then
+        echo "FAIL $name: restart"
+        rc=1
+        continue
+    fi
+    echo "ok   $name: $ids ids, $(grep -a '^restart max' "$OUT.out")"
+done
+exit $rc
@@ -0,0 +1,81 @@
+#include <stdlib.h>
+
+#include "CpuExt.h"
+#include "private.h"
+#include "CpuPool.h"
+#include "CpuBuffer.h"
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscBufferWrap
+ *
+ *  DESCRIPTION
+ *      Take a handle from the pool and point it at the payload.
+ *
+ *  RETURNS
+ *      the handle, NULL in case of out of memory
+ *----------------------------------------------------------------------------*/
+IscBuffer *IscBufferWrap(uint8 id, uint8 *base, uint8 *data, uint16 length, IscBuffer *owner)
+{
+    IscBuffer *buf;
+
+    buf = (IscBuffer *) IscPoolAlloc(id, sizeof(IscBuffer));
+    if (buf == NULL) {
+        ISCLOGE("%s id %d out of memory", __func__, id);
+        return NULL;
+    }
+    buf->data = data;
+    buf->length = length;
+    buf->id = id;
+    buf->refs = 1;
+    buf->owner = (owner != NULL) ? IscBufferRetain(owner) : NULL;
+    buf->base = (owner != NULL) ? NULL : base;
+    buf->next = NULL;
+    buf->queuedNs = 0;
+    return buf;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscBufferRetain
+ *
+ *  DESCRIPTION
+ *      Count one more reference, the caller already holds one.
+ *
+ *  RETURNS
+ *      buf
+ *----------------------------------------------------------------------------*/
+IscBuffer *IscBufferRetain(IscBuffer *buf)
+{
+    __atomic_fetch_add(&(buf->refs), 1, __ATOMIC_RELAXED);
+    return buf;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscBufferRelease
+ *
+ *  DESCRIPTION
+ *      Drop one reference, the last holder frees the handle. acq_rel so
+ *      every holder's reads of the payload finish before it is freed.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscBufferRelease(IscBuffer *buf)
+{
+    IscBuffer *owner;
+
+    if (buf == NULL) {
+        return;
+    }
+    if (__atomic_sub_fetch(&(buf->refs), 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    owner = buf->owner;
+    if (owner == NULL) {
+        IscFree(buf->base);
+    }
+    IscPoolFree(buf);
+    IscBufferRelease(owner);
+}
@@ -0,0 +1,83 @@
+#ifndef __CPU_BUFFER_H__
+#define __CPU_BUFFER_H__
+
+#include "types.h"
+#include "CpuExt.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  a received message loaned to an IscReceivedBuf callback. data and
+ *         length are read only, the rest is internal
+ */
+/* ----------------------------------------------------------------------------*/
+typedef struct IscBufferTag
+{
+    uint8 *data;                 /*message payload*/
+    uint16 length;
+    uint8 id;                    /*channel it was received on*/
+    uint32 refs;
+    struct IscBufferTag *owner;  /*framed read the payload lives in, or NULL*/
+    uint8 *base;                 /*read buffer freed with the last reference*/
+    struct IscBufferTag *next;   /*dispatch queue link*/
+    uint64_t queuedNs;           /*handed to the dispatch stage at*/
+}IscBuffer;
+
+/* buffer receive callback, retain buf to keep it after returning */
+typedef void (*IscReceivedBuf)(IscBuffer *buf);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscBufferWrap
+ *
+ *  DESCRIPTION
+ *      Make a handle with one reference for length bytes at data. With an
+ *      owner the payload lives inside the owner's read buffer and the
+ *      handle holds a reference on it, else base is the read buffer itself
+ *      and is IscFree'd with the handle. The handle comes from the pool of
+ *      channel id.
+ *
+ *  RETURNS
+ *      the handle, NULL in case of out of memory
+ *
+ *----------------------------------------------------------------------------*/
+
+IscBuffer *IscBufferWrap(uint8 id, uint8 *base, uint8 *data, uint16 length, IscBuffer *owner);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscBufferRetain
+ *
+ *  DESCRIPTION
+ *      Take another reference on buf, from any thread.
+ *
+ *  RETURNS
+ *      buf
+ *
+ *----------------------------------------------------------------------------*/
+
+IscBuffer *IscBufferRetain(IscBuffer *buf);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscBufferRelease
+ *
+ *  DESCRIPTION
+ *      Drop a reference on buf, from any thread. The last one returns the
+ *      handle to the pool and frees the read buffer, or releases the
+ *      owner. NULL is ignored.
+ *
+ *  RETURNS
+ *      void
+ *
+ *----------------------------------------------------------------------------*/
+
+void IscBufferRelease(IscBuffer *buf);
+
+#ifdef  __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,310 @@
+#include <string.h>
+#include <pthread.h>
+
+#include "isc.h"
+#include "channel_def.h"
+#include "CpuExt.h"
+#include "private.h"
+#include "CpuThread.h"
+#include "CpuChannel.h"
+#include "CpuStats.h"
+#include "CpuDispatch.h"
+#include "CpuMix.h"
+
+/* every built-in id needs a slot */
+typedef char IscChannelCountCheck[(ISC_MAX_CHANNELS >= ISC_MAX_ID) && (ISC_MAX_CHANNELS <= 255) ? 1 : -1];
+
+#define ISC_CHANNEL_NAME_SIZE   16
+
+extern IscThreadEntry* mThreadEntry[ISC_MAX_CHANNELS][ISC_MAX_TASK];
+
+ISC_CHANNALE_MATRIX_T ChannelMatrix[ISC_MAX_CHANNELS][ISC_MAX_TASK] =
+{
+    {{FUNC_WR_CHANNEL, "FuncWr"}, {FUNC_RD_CHANNEL, "FuncRd"}},
+    {{SYSD_WR_CHANNEL,"SysdWr"}, {SYSD_RD_CHANNEL, "SysdRd"}},
+    {{TESTMODE_WR_CHANNEL, "TstWr"}, {TESTMODE_RD_CHANNEL, "TstRd"}},
+    {{LOG_WR_CHANNEL, "LogWr"}, {LOG_RD_CHANNEL, "LogRd"}},
+    {{INVALID_CHANNEL,"InvaildWr"},{INVALID_CHANNEL,"InvaildRd"}},
+    {{INVALID_CHANNEL,"InvaildWr"},{INVALID_CHANNEL,"InvaildRd"}},
+    {{HID_WR_CHANNEL,"HidWr"},{HID_RD_CHANNEL,"HidRd"}},
+    {{MIX_WR_CHANNEL,"MixWr"},{MIX_RD_CHANNEL,"MixRd"}},
+    {{INVALID_CHANNEL,"InvaildWr"},{ITRONECNS_RD_CHANNEL,"EcnsRd"}},
+    /*the rows free for IscChannelAdd are set up by IscChannelInit*/
+};
+ /* {queueCapacity, queueBytes, batchBytes, batchLingerMs, readyMode, pollIntervalUs, laneWeight,
+  *  threadPriority, cpuMask}
+  * batching changes the wire format, enable it on both ends together */
+ISC_CHANNEL_CONFIG_T ChannelConfig[ISC_MAX_CHANNELS][ISC_MAX_TASK] =
+{
+    {{ISC_DEFAULT_QUEUE_CAPACITY, ISC_DEFAULT_QUEUE_BYTES, 0, 0, 0, 0, {0, 0, 0}, ISC_THREAD_PRIORITY_NORMAL, 0}, {0, 0, 0, 0, ISC_READY_POLL, ISC_DEFAULT_POLL_US, {0, 0, 0}, ISC_THREAD_PRIORITY_NORMAL, 0}},
+    {{64, 16*1024, 0, 0, 0, 0, {0, 0, 0}, ISC_THREAD_PRIORITY_NORMAL, 0}, {0, 0, 0, 0, ISC_READY_POLL, ISC_DEFAULT_POLL_US, {0, 0, 0}, ISC_THREAD_PRIORITY_NORMAL, 0}},
+    {{ISC_DEFAULT_QUEUE_CAPACITY, ISC_DEFAULT_QUEUE_BYTES, 0, 0, 0, 0, {0, 0, 0}, ISC_THREAD_PRIORITY_NORMAL, 0}, {0, 0, 0, 0, ISC_READY_POLL, ISC_DEFAULT_POLL_US, {0, 0, 0}, ISC_THREAD_PRIORITY_NORMAL, 0}},
+    {{1024, 256*1024, 0, 0, 0, 0, {0, 0, 0}, ISC_THREAD_PRIORITY_NORMAL, 0}, {0, 0, 0, 0, ISC_READY_POLL, ISC_DEFAULT_POLL_US, {0, 0, 0}, ISC_THREAD_PRIORITY_NORMAL, 0}},
+    {{0, 0, 0, 0, 0, 0, {0, 0, 0}, ISC_THREAD_PRIORITY_NORMAL, 0}, {0, 0, 0, 0, 0, 0, {0, 0, 0}, ISC_THREAD_PRIORITY_NORMAL, 0}},
+    {{0, 0, 0, 0, 0, 0, {0, 0, 0}, ISC_THREAD_PRIORITY_NORMAL, 0}, {0, 0, 0, 0, 0, 0, {0, 0, 0}, ISC_THREAD_PRIORITY_NORMAL, 0}},
+    {{128, 32*1024, 0, 0, 0, 0, {0, 0, 0}, ISC_THREAD_PRIORITY_NORMAL, 0}, {0, 0, 0, 0, ISC_READY_POLL, ISC_DEFAULT_POLL_US, {0, 0, 0}, ISC_THREAD_PRIORITY_NORMAL, 0}},
+    {{ISC_DEFAULT_QUEUE_CAPACITY, ISC_DEFAULT_QUEUE_BYTES, 0, 0, 0, 0, {0, 0, 0}, ISC_THREAD_PRIORITY_NORMAL, 0}, {0, 0, 0, 0, ISC_READY_POLL, ISC_DEFAULT_POLL_US, {0, 0, 0}, ISC_THREAD_PRIORITY_NORMAL, 0}},
+    {{0, 0, 0, 0, 0, 0, {0, 0, 0}, ISC_THREAD_PRIORITY_NORMAL, 0}, {0, 0, 0, 0, ISC_READY_POLL, ISC_DEFAULT_POLL_US, {0, 0, 0}, ISC_THREAD_PRIORITY_NORMAL, 0}},
+};
+
+/* names of the channels added at runtime, ChannelMatrix points here */
+static int8 channelName[ISC_MAX_CHANNELS][ISC_MAX_TASK][ISC_CHANNEL_NAME_SIZE];
+static pthread_once_t channelOnce = PTHREAD_ONCE_INIT;
+
+static void IscChannelInitOnce(void)
+{
+    uint8 id;
+    uint8 task;
+
+    for (id = ISC_MAX_ID; id < ISC_MAX_CHANNELS; id++) {
+        for (task = ISC_WR_TASK; task < ISC_MAX_TASK; task++) {
+            ChannelMatrix[id][task].name = NULL;
+            __atomic_store_n(&(ChannelMatrix[id][task].ch), INVALID_CHANNEL, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+/* fill in what a zeroed config leaves out */
+static void IscChannelDefaults(ISC_CHANNEL_CONFIG_T *config, uint8 task)
+{
+    if (task == ISC_WR_TASK) {
+        if (config->queueCapacity == 0) {
+            config->queueCapacity = ISC_DEFAULT_QUEUE_CAPACITY;
+        }
+    } else if (config->pollIntervalUs == 0) {
+        config->pollIntervalUs = ISC_DEFAULT_POLL_US;
+    }
+}
+
+/* caller holds the global mutex. Backends look a channel number up in its
+ * task column and take the first id that has it, a second one would never
+ * see a message. */
+static uint8 IscChannelTaken(uint32 ch, uint8 task)
+{
+    uint8 id;
+
+    if (ch == INVALID_CHANNEL) {
+        return 0;
+    }
+    for (id = 0; id < ISC_MAX_CHANNELS; id++) {
+        if (__atomic_load_n(&(ChannelMatrix[id][task].ch), __ATOMIC_ACQUIRE) == ch) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* caller holds the global mutex */
+static uint8 IscChannelHasTasks(uint8 id)
+{
+    uint8 task;
+
+    for (task = ISC_WR_TASK; task < ISC_MAX_TASK; task++) {
+        if (__atomic_load_n(&(mThreadEntry[id][task]), __ATOMIC_ACQUIRE) != NULL) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscChannelInit
+ *
+ *  DESCRIPTION
+ *      Mark the rows behind the built-in ids as free, once.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscChannelInit(void)
+{
+    (void) pthread_once(&channelOnce, IscChannelInitOnce);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscChannelAdd
+ *
+ *  DESCRIPTION
+ *      Copy desc into the free row of id. The channel numbers are stored
+ *      last, a row becomes visible to channel lookups complete.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_HANDLE   in case the id is out of range
+ *          ISC_RESULT_INVALID_POINTER  in case desc is invalid
+ *          ISC_RESULT_ALREADY_EXISTS   in case another id has a channel of desc
+ *          ISC_RESULT_FAILURE          in case the id is in use
+ *----------------------------------------------------------------------------*/
+IscResult IscChannelAdd(uint8 id, const ISC_CHANNEL_DESC_T *desc)
+{
+    uint8 task;
+
+    if (id >= ISC_MAX_CHANNELS) {
+        return ISC_RESULT_INVALID_HANDLE;
+    }
+    if (desc == NULL) {
+        return ISC_RESULT_INVALID_POINTER;
+    }
+    IscChannelInit();
+    IscGlobalMutexLock();
+    if (IscChannelInUse(id) || IscChannelHasTasks(id)) {
+        IscGlobalMutexUnlock();
+        ISCLOGE("%s id %d is in use", __func__, id);
+        return ISC_RESULT_FAILURE;
+    }
+    for (task = ISC_WR_TASK; task < ISC_MAX_TASK; task++) {
+        if (IscChannelTaken(desc->ch[task], task)) {
+            IscGlobalMutexUnlock();
+            ISCLOGE("%s id %d channel %u is registered already", __func__, id, desc->ch[task]);
+            return ISC_RESULT_ALREADY_EXISTS;
+        }
+    }
+    for (task = ISC_WR_TASK; task < ISC_MAX_TASK; task++) {
+        ChannelConfig[id][task] = desc->config[task];
+        IscChannelDefaults(&(ChannelConfig[id][task]), task);
+        channelName[id][task][0] = 0;
+        if (desc->name[task] != NULL) {
+            strncpy((char *) channelName[id][task], (const char *) desc->name[task],
+                    ISC_CHANNEL_NAME_SIZE - 1);
+            channelName[id][task][ISC_CHANNEL_NAME_SIZE - 1] = 0;
+        }
+        ChannelMatrix[id][task].name = channelName[id][task];
+    }
+    for (task = ISC_WR_TASK; task < ISC_MAX_TASK; task++) {
+        __atomic_store_n(&(ChannelMatrix[id][task].ch), desc->ch[task], __ATOMIC_RELEASE);
+    }
+    IscGlobalMutexUnlock();
+    ISCLOGI("%s: id %d wr %u rd %u", __func__, id, desc->ch[ISC_WR_TASK], desc->ch[ISC_RD_TASK]);
+    return ISC_RESULT_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscChannelRemove
+ *
+ *  DESCRIPTION
+ *      Deinit the tasks, then reset the per-id state and invalidate the
+ *      channel numbers of the row, both under the global mutex.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_HANDLE   in case the id is out of range
+ *          ISC_RESULT_FAILURE          in case the tasks cannot be stopped
+ *----------------------------------------------------------------------------*/
+IscResult IscChannelRemove(uint8 id)
+{
+    uint8 task;
+
+    if (id >= ISC_MAX_CHANNELS) {
+        return ISC_RESULT_INVALID_HANDLE;
+    }
+    if (IscThreadDeinit(id) != ISC_SUCCESS) {
+        return ISC_RESULT_FAILURE;
+    }
+    IscGlobalMutexLock();
+    if (IscChannelHasTasks(id)) {
+        /*initialised again meanwhile*/
+        IscGlobalMutexUnlock();
+        return ISC_RESULT_FAILURE;
+    }
+    IscThreadResetId(id);
+    IscDispatchReset(id);
+    IscStatsReset(id);
+    if (id == ISC_MIX_ID) {
+        IscMixReset();
+    }
+    for (task = ISC_WR_TASK; task < ISC_MAX_TASK; task++) {
+        __atomic_store_n(&(ChannelMatrix[id][task].ch), INVALID_CHANNEL, __ATOMIC_RELEASE);
+    }
+    IscGlobalMutexUnlock();
+    ISCLOGI("%s: id %d", __func__, id);
+    return ISC_RESULT_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscChannelSetConfig
+ *
+ *  DESCRIPTION
+ *      Overwrite the tuning of a task of an id without tasks.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_HANDLE   in case the id or task is out of range
+ *          ISC_RESULT_INVALID_POINTER  in case config is invalid
+ *          ISC_RESULT_FAILURE          in case the id has tasks
+ *----------------------------------------------------------------------------*/
+IscResult IscChannelSetConfig(uint8 id, uint8 task, const ISC_CHANNEL_CONFIG_T *config)
+{
+    if ((id >= ISC_MAX_CHANNELS) || (task >= ISC_MAX_TASK)) {
+        return ISC_RESULT_INVALID_HANDLE;
+    }
+    if (config == NULL) {
+        return ISC_RESULT_INVALID_POINTER;
+    }
+    IscGlobalMutexLock();
+    if (IscChannelHasTasks(id)) {
+        IscGlobalMutexUnlock();
+        ISCLOGE("%s id %d is running, deinit it first", __func__, id);
+        return ISC_RESULT_FAILURE;
+    }
+    ChannelConfig[id][task] = *config;
+    IscChannelDefaults(&(ChannelConfig[id][task]), task);
+    IscGlobalMutexUnlock();
+    return ISC_RESULT_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscChannelGetConfig
+ *
+ *  DESCRIPTION
+ *      Copy out the tuning of a task of id.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_HANDLE   in case the id or task is out of range
+ *          ISC_RESULT_INVALID_POINTER  in case config is invalid
+ *----------------------------------------------------------------------------*/
+IscResult IscChannelGetConfig(uint8 id, uint8 task, ISC_CHANNEL_CONFIG_T *config)
+{
+    if ((id >= ISC_MAX_CHANNELS) || (task >= ISC_MAX_TASK)) {
+        return ISC_RESULT_INVALID_HANDLE;
+    }
+    if (config == NULL) {
+        return ISC_RESULT_INVALID_POINTER;
+    }
+    IscGlobalMutexLock();
+    *config = ChannelConfig[id][task];
+    IscGlobalMutexUnlock();
+    return ISC_RESULT_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscChannelInUse
+ *
+ *  RETURNS
+ *      1 if id has a read or a write channel
+ *----------------------------------------------------------------------------*/
+uint8 IscChannelInUse(uint8 id)
+{
+    uint8 task;
+
+    if (id >= ISC_MAX_CHANNELS) {
+        return 0;
+    }
+    IscChannelInit();
+    for (task = ISC_WR_TASK; task < ISC_MAX_TASK; task++) {
+        if (__atomic_load_n(&(ChannelMatrix[id][task].ch), __ATOMIC_ACQUIRE) != INVALID_CHANNEL) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,143 @@
+#ifndef __CPU_CHANNEL_H__
+#define __CPU_CHANNEL_H__
+
+#include "types.h"
+#include "CpuExt.h"
+#include "private.h"
+#include "CpuThread.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/* Channel ids 0 .. ISC_MAX_CHANNELS-1. The first ISC_MAX_ID are the built-in
+ * channels of ChannelMatrix, the others are free for IscChannelAdd. */
+#ifndef ISC_MAX_CHANNELS
+#define ISC_MAX_CHANNELS    32
+#endif
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  a channel id for IscChannelAdd, one entry per task
+ */
+/* ----------------------------------------------------------------------------*/
+typedef struct
+{
+    uint32 ch[ISC_MAX_TASK];             /*backend channel, INVALID_CHANNEL: no such task*/
+    const int8 *name[ISC_MAX_TASK];      /*thread name, copied and cut to 15 characters*/
+    ISC_CHANNEL_CONFIG_T config[ISC_MAX_TASK];  /*0 capacity or poll period: defaults*/
+}ISC_CHANNEL_DESC_T;
+
+/* The registry, indexed by id and task. Lookups are plain array reads: a
+ * row only changes while its id has no tasks (IscThreadInit not called or
+ * undone by IscThreadDeinit), so the running tasks never see it move. The
+ * rows from ISC_MAX_ID on are valid after IscChannelInit. */
+extern ISC_CHANNALE_MATRIX_T ChannelMatrix[ISC_MAX_CHANNELS][ISC_MAX_TASK];
+extern ISC_CHANNEL_CONFIG_T ChannelConfig[ISC_MAX_CHANNELS][ISC_MAX_TASK];
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscChannelInit
+ *
+ *  DESCRIPTION
+ *      Set the channels of the ids from ISC_MAX_ID on to INVALID_CHANNEL.
+ *      Runs once, IscThreadInit, IscLoopbackInit and the IscChannel calls
+ *      do it; a backend scanning ChannelMatrix before those calls it first.
+ *
+ *  RETURNS
+ *      void
+ *
+ *----------------------------------------------------------------------------*/
+
+void IscChannelInit(void);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscChannelAdd
+ *
+ *  DESCRIPTION
+ *      Register channel id with the channels, names and tuning of desc.
+ *      IscThreadInit brings its tasks up afterwards. Tasks whose channel is
+ *      INVALID_CHANNEL get no thread.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_HANDLE   in case the id is out of range
+ *          ISC_RESULT_INVALID_POINTER  in case desc is invalid
+ *          ISC_RESULT_ALREADY_EXISTS   in case another id has the read or
+ *                                      the write channel of desc
+ *          ISC_RESULT_FAILURE          in case the id is in use
+ *
+ *----------------------------------------------------------------------------*/
+
+IscResult IscChannelAdd(uint8 id, const ISC_CHANNEL_DESC_T *desc);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscChannelRemove
+ *
+ *  DESCRIPTION
+ *      Stop the tasks of id like IscThreadDeinit, then free the id for
+ *      IscChannelAdd. Its callbacks, dispatch mode, counters and last write
+ *      result are dropped, for ISC_MIX_ID the mix_id callbacks too, so the
+ *      next user starts clean. Built-in ids may be removed too.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_HANDLE   in case the id is out of range
+ *          ISC_RESULT_FAILURE          in case the tasks cannot be stopped
+ *
+ *----------------------------------------------------------------------------*/
+
+IscResult IscChannelRemove(uint8 id);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscChannelSetConfig
+ *
+ *  DESCRIPTION
+ *      Replace the tuning of one task of id. Only while the id has no
+ *      tasks, a deinit/init cycle around it applies new settings.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_HANDLE   in case the id or task is out of range
+ *          ISC_RESULT_INVALID_POINTER  in case config is invalid
+ *          ISC_RESULT_FAILURE          in case the id has tasks
+ *
+ *----------------------------------------------------------------------------*/
+
+IscResult IscChannelSetConfig(uint8 id, uint8 task, const ISC_CHANNEL_CONFIG_T *config);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscChannelGetConfig
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_HANDLE   in case the id or task is out of range
+ *          ISC_RESULT_INVALID_POINTER  in case config is invalid
+ *
+ *----------------------------------------------------------------------------*/
+
+IscResult IscChannelGetConfig(uint8 id, uint8 task, ISC_CHANNEL_CONFIG_T *config);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscChannelInUse
+ *
+ *  RETURNS
+ *      1 if id has a read or a write channel
+ *
+ *----------------------------------------------------------------------------*/
+
+uint8 IscChannelInUse(uint8 id);
+
+#ifdef  __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,603 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "CpuExt.h"
+#include "private.h"
+#include "CpuThread.h"
+#include "CpuChannel.h"
+#include "CpuStats.h"
+#include "CpuDispatch.h"
+
+/* one strand per id, and per (id, mix_id) for ids in ISC_DISPATCH_MIX */
+#define ISC_DISPATCH_STRANDS    ISC_MAX_CHANNELS
+#define ISC_DISPATCH_MIX_IDS    256
+
+#define ISC_DISPATCH_WAKE_EVENT 0x00000001
+
+/* messages whose callbacks must run one after the other */
+typedef struct IscStrandTag
+{
+    IscMutexHandle mutex;
+    IscBuffer *head;             /*queued messages in read order*/
+    IscBuffer *tail;
+    uint8 scheduled;             /*on a run queue or being run by a worker*/
+    struct IscStrandTag *next;   /*run queue link*/
+}IscStrand;
+
+typedef struct
+{
+    IscMutexHandle mutex;
+    IscStrand *head;             /*run queue: strands with messages*/
+    IscStrand *tail;
+    IscEventHandle event;
+    IscThreadHandle thread;
+    uint8 index;
+}IscDispatchWorker;
+
+static IscStrand dispatchStrand[ISC_DISPATCH_STRANDS];
+static IscStrand *dispatchMix[ISC_MAX_CHANNELS];  /*mix strands of id, made by the first
+                                                    IscSetDispatchMode to MIX and kept*/
+static IscDispatchWorker dispatchWorker[ISC_DISPATCH_MAX_WORKERS];
+static uint8 dispatchWorkers = 0;        /*pool size, 0 while stopped*/
+static uint8 dispatchRunning = 0;        /*IscDispatchSubmit accepts messages*/
+static uint8 dispatchStopping = 0;       /*workers exit once out of work*/
+static uint32 dispatchSubmitting = 0;    /*readers inside IscDispatchSubmit*/
+static uint32 dispatchIdle = 0;          /*bit n: worker n is asleep*/
+static uint8 dispatchMode[ISC_MAX_CHANNELS];
+static uint8 dispatchUsed[ISC_MAX_CHANNELS];     /*mode the pending messages were queued in*/
+static uint32 dispatchPending[ISC_MAX_CHANNELS]; /*messages of id queued or running*/
+static uint32 dispatchHeld[ISC_MAX_CHANNELS];    /*reader of id waits for pending to drop
+                                                   below this, 0 if it does not wait*/
+/* created by the first IscDispatchStart and kept, a late set is harmless */
+static uint8 dispatchEventsReady = 0;
+static IscEventHandle dispatchQuiet;             /*last reader left after IscDispatchStop*/
+static IscEventHandle dispatchDrained[ISC_MAX_CHANNELS];  /*pending of id dropped to 0*/
+static uint32 dispatchDrainWait[ISC_MAX_CHANNELS];        /*readers waiting for that*/
+static __thread uint8 dispatchSelf = 0;          /*set on the worker threads*/
+
+/* a callback of id finished: resume its reader once below its mark */
+static void IscDispatchDone(uint8 id)
+{
+    uint32 left = __atomic_sub_fetch(&(dispatchPending[id]), 1, __ATOMIC_SEQ_CST);
+    uint32 mark = __atomic_load_n(&(dispatchHeld[id]), __ATOMIC_SEQ_CST);
+
+    if ((mark != 0) && (left < mark) &&
+        (__atomic_exchange_n(&(dispatchHeld[id]), 0, __ATOMIC_SEQ_CST) != 0)) {
+        IscNotifyReadable(id);
+    }
+    if ((left == 0) && (__atomic_load_n(&(dispatchDrainWait[id]), __ATOMIC_SEQ_CST) != 0)) {
+        (void) IscEventSet(&(dispatchDrained[id]), ISC_DISPATCH_WAKE_EVENT);
+    }
+}
+
+/* a reader is out of IscDispatchEnter/IscDispatchLeave, IscDispatchStop
+ * may wait for the last one */
+static void IscDispatchExit(void)
+{
+    if ((__atomic_sub_fetch(&dispatchSubmitting, 1, __ATOMIC_SEQ_CST) == 0) &&
+        !__atomic_load_n(&dispatchRunning, __ATOMIC_SEQ_CST) &&
+        __atomic_load_n(&dispatchEventsReady, __ATOMIC_ACQUIRE)) {
+        (void) IscEventSet(&dispatchQuiet, ISC_DISPATCH_WAKE_EVENT);
+    }
+}
+
+/* wake the home worker of a strand if it sleeps, else any sleeping one to steal */
+static void IscDispatchWakeIdle(uint8 home)
+{
+    uint32 idle = __atomic_load_n(&dispatchIdle, __ATOMIC_SEQ_CST);
+    uint8 target;
+
+    if (idle == 0) {
+        return;
+    }
+    target = (idle & (1u << home)) ? home : (uint8) __builtin_ctz(idle);
+    if (__atomic_fetch_and(&dispatchIdle, ~(1u << target), __ATOMIC_SEQ_CST) & (1u << target)) {
+        (void) IscEventSet(&(dispatchWorker[target].event), ISC_DISPATCH_WAKE_EVENT);
+    }
+}
+
+static void IscDispatchPush(IscDispatchWorker *worker, IscStrand *strand)
+{
+    strand->next = NULL;
+    IscMutexLock(&(worker->mutex));
+    if (worker->tail != NULL) {
+        worker->tail->next = strand;
+    } else {
+        worker->head = strand;
+    }
+    worker->tail = strand;
+    IscMutexUnlock(&(worker->mutex));
+    IscDispatchWakeIdle(worker->index);
+}
+
+static IscStrand *IscDispatchPop(IscDispatchWorker *worker)
+{
+    IscStrand *strand;
+
+    IscMutexLock(&(worker->mutex));
+    strand = worker->head;
+    if (strand != NULL) {
+        worker->head = strand->next;
+        if (worker->head == NULL) {
+            worker->tail = NULL;
+        }
+    }
+    IscMutexUnlock(&(worker->mutex));
+    return strand;
+}
+
+/* own run queue first, then steal from the others */
+static IscStrand *IscDispatchTake(IscDispatchWorker *worker)
+{
+    IscStrand *strand = IscDispatchPop(worker);
+    uint8 i;
+
+    for (i = 1; (strand == NULL) && (i < dispatchWorkers); i++) {
+        strand = IscDispatchPop(&(dispatchWorker[(worker->index + i) % dispatchWorkers]));
+    }
+    return strand;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscDispatchRunStrand
+ *
+ *  DESCRIPTION
+ *      Run up to ISC_DISPATCH_RUN_BUDGET callbacks of a strand, then put it
+ *      back on the worker's run queue if messages are left. The strand
+ *      stays scheduled meanwhile, so no other worker runs it.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+static void IscDispatchRunStrand(IscDispatchWorker *worker, IscStrand *strand)
+{
+    IscBuffer *buf;
+    IscBuffer *last;
+    IscBuffer *next;
+    uint32 count = 1;
+    uint8 again;
+
+    IscMutexLock(&(strand->mutex));
+    buf = strand->head;
+    last = buf;
+    while ((last != NULL) && (count < ISC_DISPATCH_RUN_BUDGET) && (last->next != NULL)) {
+        last = last->next;
+        count++;
+    }
+    if (last != NULL) {
+        strand->head = last->next;
+        if (strand->head == NULL) {
+            strand->tail = NULL;
+        }
+        last->next = NULL;
+    }
+    IscMutexUnlock(&(strand->mutex));
+
+    for (; buf != NULL; buf = next) {
+        next = buf->next;
+        IscStatsDispatch(buf->id, worker->index, IscTimeNowNs() - buf->queuedNs);
+        IscReceiveDeliver(buf->id, buf);
+        IscDispatchDone(buf->id);
+        IscBufferRelease(buf);
+    }
+
+    IscMutexLock(&(strand->mutex));
+    again = (strand->head != NULL);
+    if (!again) {
+        strand->scheduled = 0;
+    }
+    IscMutexUnlock(&(strand->mutex));
+    if (again) {
+        IscDispatchPush(worker, strand);
+    }
+}
+
+static void IscDispatchRun(void *data)
+{
+    IscDispatchWorker *worker = (IscDispatchWorker *) data;
+    uint32 bit = 1u << worker->index;
+    IscStrand *strand;
+    uint32 eventBits;
+
+    dispatchSelf = 1;
+    for (;;) {
+        strand = IscDispatchTake(worker);
+        if (strand == NULL) {
+            /*announce the sleep, then look again so no push is missed*/
+            __atomic_fetch_or(&dispatchIdle, bit, __ATOMIC_SEQ_CST);
+            strand = IscDispatchTake(worker);
+            if (strand == NULL) {
+                if (__atomic_load_n(&dispatchStopping, __ATOMIC_SEQ_CST)) {
+                    __atomic_fetch_and(&dispatchIdle, ~bit, __ATOMIC_SEQ_CST);
+                    break;
+                }
+                (void) IscEventWait(&(worker->event), ISC_EVENT_WAIT_INFINITE, &eventBits);
+                continue;
+            }
+            __atomic_fetch_and(&dispatchIdle, ~bit, __ATOMIC_SEQ_CST);
+        }
+        IscDispatchRunStrand(worker, strand);
+    }
+    ISCLOGT("%s worker %d exit", __func__, worker->index);
+}
+
+/* let the first started workers run out of work and exit, then free them */
+static void IscDispatchJoin(uint8 started)
+{
+    uint32 i;
+
+    __atomic_store_n(&dispatchStopping, 1, __ATOMIC_SEQ_CST);
+    for (i = 0; i < started; i++) {
+        (void) IscEventSet(&(dispatchWorker[i].event), ISC_DISPATCH_WAKE_EVENT);
+    }
+    for (i = 0; i < started; i++) {
+        (void) IscThreadJoin(&(dispatchWorker[i].thread));
+    }
+    for (i = 0; i < dispatchWorkers; i++) {
+        IscEventDestroy(&(dispatchWorker[i].event));
+        IscMutexDestroy(&(dispatchWorker[i].mutex));
+    }
+    for (i = 0; i < ISC_DISPATCH_STRANDS; i++) {
+        IscMutexDestroy(&(dispatchStrand[i].mutex));
+    }
+    __atomic_store_n(&dispatchIdle, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&dispatchWorkers, 0, __ATOMIC_RELEASE);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscDispatchStart
+ *
+ *  DESCRIPTION
+ *      Set up the strands and start the workers.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_NO_MORE_THREADS  in case a worker cannot be started
+ *          ISC_RESULT_FAILURE          otherwise
+ *----------------------------------------------------------------------------*/
+IscResult IscDispatchStart(uint8 workers)
+{
+    char name[16];
+    uint32 i;
+
+    if ((workers == 0) || (workers > ISC_DISPATCH_MAX_WORKERS)) {
+        return ISC_RESULT_FAILURE;
+    }
+    IscGlobalMutexLock();
+    if (dispatchWorkers != 0) {
+        IscGlobalMutexUnlock();
+        return ISC_RESULT_FAILURE;
+    }
+    for (i = 0; (i < ISC_MAX_CHANNELS) && !dispatchEventsReady; i++) {
+        (void) IscEventCreate(&(dispatchDrained[i]));
+    }
+    if (!dispatchEventsReady) {
+        (void) IscEventCreate(&dispatchQuiet);
+        __atomic_store_n(&dispatchEventsReady, 1, __ATOMIC_RELEASE);
+    }
+    for (i = 0; i < ISC_DISPATCH_STRANDS; i++) {
+        IscStrand *strand = &(dispatchStrand[i]);
+
+        (void) IscMutexCreate(&(strand->mutex));
+        strand->head = NULL;
+        strand->tail = NULL;
+        strand->scheduled = 0;
+        strand->next = NULL;
+    }
+    dispatchStopping = 0;
+    dispatchWorkers = workers;
+    for (i = 0; i < workers; i++) {
+        IscDispatchWorker *worker = &(dispatchWorker[i]);
+
+        (void) IscMutexCreate(&(worker->mutex));
+        (void) IscEventCreate(&(worker->event));
+        worker->head = NULL;
+        worker->tail = NULL;
+        worker->index = (uint8) i;
+    }
+    for (i = 0; i < workers; i++) {
+        snprintf(name, sizeof(name), "IscDispatch%u", i);
+        if (IscThreadCreateEx(IscDispatchRun, &(dispatchWorker[i]), ISC_DEFAULT_STACK_SIZE,
+                              ISC_THREAD_PRIORITY_NORMAL, 0, (const int8 *) name,
+                              &(dispatchWorker[i].thread)) != ISC_RESULT_SUCCESS) {
+            ISCLOGE("%s worker %u create error", __func__, i);
+            IscDispatchJoin((uint8) i);
+            IscGlobalMutexUnlock();
+            return ISC_RESULT_NO_MORE_THREADS;
+        }
+    }
+    __atomic_store_n(&dispatchRunning, 1, __ATOMIC_SEQ_CST);
+    IscGlobalMutexUnlock();
+    ISCLOGI("%s: %d workers", __func__, workers);
+    return ISC_RESULT_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscDispatchStop
+ *
+ *  DESCRIPTION
+ *      Refuse new messages, wait for readers still submitting, then let the
+ *      workers finish the queued callbacks and join them. The global mutex
+ *      is not held while joining, callbacks may need it.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscDispatchStop(void)
+{
+    uint32 eventBits;
+
+    IscGlobalMutexLock();
+    if (!dispatchRunning) {
+        IscGlobalMutexUnlock();
+        return;
+    }
+    __atomic_store_n(&dispatchRunning, 0, __ATOMIC_SEQ_CST);
+    IscGlobalMutexUnlock();
+
+    while (__atomic_load_n(&dispatchSubmitting, __ATOMIC_SEQ_CST) != 0) {
+        (void) IscEventWait(&dispatchQuiet, ISC_EVENT_WAIT_INFINITE, &eventBits);
+    }
+    IscDispatchJoin(dispatchWorkers);
+    ISCLOGI("%s: done", __func__);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscSetDispatchMode
+ *
+ *  DESCRIPTION
+ *      Store the mode, the read task looks it up per read. The mix strands
+ *      of id are made before the mode is, so a reader that sees it finds
+ *      them.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_HANDLE   in case the id is invalid
+ *          ISC_RESULT_FAILURE          in case the mode is unknown or no
+ *                                      memory for the mix strands
+ *----------------------------------------------------------------------------*/
+IscResult IscSetDispatchMode(uint8 id, uint8 mode)
+{
+    IscStrand *mix;
+    uint32 i;
+
+    if (id >= ISC_MAX_CHANNELS) {
+        return ISC_RESULT_INVALID_HANDLE;
+    }
+    if (mode > ISC_DISPATCH_MIX) {
+        return ISC_RESULT_FAILURE;
+    }
+    if (mode == ISC_DISPATCH_MIX) {
+        IscGlobalMutexLock();
+        if (dispatchMix[id] == NULL) {
+            mix = (IscStrand *) IscMalloc(ISC_DISPATCH_MIX_IDS * sizeof(IscStrand));
+            if (mix == NULL) {
+                IscGlobalMutexUnlock();
+                ISCLOGE("%s id %d no memory for mix strands", __func__, id);
+                return ISC_RESULT_FAILURE;
+            }
+            for (i = 0; i < ISC_DISPATCH_MIX_IDS; i++) {
+                (void) IscMutexCreate(&(mix[i].mutex));
+                mix[i].head = NULL;
+                mix[i].tail = NULL;
+                mix[i].scheduled = 0;
+                mix[i].next = NULL;
+            }
+            __atomic_store_n(&(dispatchMix[id]), mix, __ATOMIC_RELEASE);
+        }
+        IscGlobalMutexUnlock();
+    }
+    __atomic_store_n(&(dispatchMode[id]), mode, __ATOMIC_RELEASE);
+    return ISC_RESULT_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscDispatchReset
+ *
+ *  DESCRIPTION
+ *      Forget the mode of id.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscDispatchReset(uint8 id)
+{
+    if (id < ISC_MAX_CHANNELS) {
+        __atomic_store_n(&(dispatchMode[id]), ISC_DISPATCH_INLINE, __ATOMIC_RELAXED);
+    }
+}
+
+/* where messages of id go if nothing is pending */
+static uint8 IscDispatchWanted(uint8 id)
+{
+    if (!__atomic_load_n(&dispatchRunning, __ATOMIC_SEQ_CST)) {
+        return ISC_DISPATCH_INLINE;
+    }
+    return __atomic_load_n(&(dispatchMode[id]), __ATOMIC_ACQUIRE);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscDispatchHold
+ *
+ *  DESCRIPTION
+ *      Hold the reader back while a strand of id is full, until half of it
+ *      ran, or while messages queued before a mode change or IscDispatchStop
+ *      are pending, until all of them ran. The worker that gets there calls
+ *      IscNotifyReadable. The mark is set before pending is looked at
+ *      again, so a worker that passed it meanwhile is not missed.
+ *
+ *  RETURNS
+ *      1 if the reader must not read now
+ *----------------------------------------------------------------------------*/
+uint8 IscDispatchHold(uint8 id)
+{
+    uint32 pending;
+    uint32 mark;
+    uint32 was;
+
+    if (id >= ISC_MAX_CHANNELS) {
+        return 0;
+    }
+    pending = __atomic_load_n(&(dispatchPending[id]), __ATOMIC_SEQ_CST);
+    if (pending == 0) {
+        return 0;
+    }
+    if (pending >= ISC_DISPATCH_QUEUE_MAX) {
+        mark = ISC_DISPATCH_QUEUE_MAX / 2;
+    }
+    else if (IscDispatchWanted(id) != __atomic_load_n(&(dispatchUsed[id]), __ATOMIC_RELAXED)) {
+        mark = 1;
+    }
+    else {
+        return 0;
+    }
+
+    was = __atomic_exchange_n(&(dispatchHeld[id]), mark, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&(dispatchPending[id]), __ATOMIC_SEQ_CST) < mark) {
+        (void) __atomic_exchange_n(&(dispatchHeld[id]), 0, __ATOMIC_SEQ_CST);
+        return 0;
+    }
+    if ((was == 0) && (mark != 1)) {
+        IscStatsDispatchStall(id);
+    }
+    return 1;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscDispatchHeld
+ *
+ *  RETURNS
+ *      1 if the reader of id waits for IscNotifyReadable from a worker
+ *----------------------------------------------------------------------------*/
+uint8 IscDispatchHeld(uint8 id)
+{
+    return (id < ISC_MAX_CHANNELS) && (__atomic_load_n(&(dispatchHeld[id]), __ATOMIC_SEQ_CST) != 0);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscDispatchEnter
+ *
+ *  DESCRIPTION
+ *      Take the mode of id for the messages of one read. While messages are
+ *      pending it stays the mode they were queued in. Once the pool stops
+ *      the messages run inline, after the pending ones: IscDispatchHold
+ *      keeps the reader back for that, only a read that raced with
+ *      IscDispatchStop waits here, on the event the last of them sets.
+ *
+ *  RETURNS
+ *      1 if the messages go to IscDispatchSubmit, IscDispatchLeave follows
+ *----------------------------------------------------------------------------*/
+uint8 IscDispatchEnter(uint8 id)
+{
+    uint32 eventBits;
+    uint8 mode;
+
+    if (id >= ISC_MAX_CHANNELS) {
+        return 0;
+    }
+    __atomic_fetch_add(&dispatchSubmitting, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&dispatchRunning, __ATOMIC_SEQ_CST)) {
+        /*IscDispatchStop came after IscDispatchHold and may not wait for
+          this reader: let the workers finish id before running it inline.
+          Pending is only non-zero once the pool ran, the events exist*/
+        IscDispatchExit();
+        __atomic_fetch_add(&(dispatchDrainWait[id]), 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&(dispatchPending[id]), __ATOMIC_SEQ_CST) != 0) {
+            (void) IscEventWait(&(dispatchDrained[id]), ISC_EVENT_WAIT_INFINITE, &eventBits);
+        }
+        __atomic_fetch_sub(&(dispatchDrainWait[id]), 1, __ATOMIC_SEQ_CST);
+        return 0;
+    }
+    if (__atomic_load_n(&(dispatchPending[id]), __ATOMIC_SEQ_CST) == 0) {
+        mode = IscDispatchWanted(id);
+        __atomic_store_n(&(dispatchUsed[id]), mode, __ATOMIC_RELAXED);
+    }
+    else {
+        mode = __atomic_load_n(&(dispatchUsed[id]), __ATOMIC_RELAXED);
+    }
+    if (mode == ISC_DISPATCH_INLINE) {
+        IscDispatchExit();
+        return 0;
+    }
+    return 1;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscDispatchLeave
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscDispatchLeave(void)
+{
+    IscDispatchExit();
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscDispatchIsWorker
+ *
+ *  RETURNS
+ *      1 when called on a dispatch worker thread
+ *----------------------------------------------------------------------------*/
+uint8 IscDispatchIsWorker(void)
+{
+    return dispatchSelf;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscDispatchSubmit
+ *
+ *  DESCRIPTION
+ *      Append buf to its strand and schedule the strand on its home worker
+ *      if it was not scheduled yet. In ISC_DISPATCH_MIX the strand is the
+ *      one of the id and the first byte, so equal mix_ids of different ids
+ *      still run in parallel.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscDispatchSubmit(IscBuffer *buf)
+{
+    IscStrand *strand = &(dispatchStrand[buf->id]);
+    IscStrand *mix;
+    uint32 home = buf->id;
+    uint8 push;
+
+    if ((__atomic_load_n(&(dispatchUsed[buf->id]), __ATOMIC_RELAXED) == ISC_DISPATCH_MIX) &&
+        (buf->length != 0)) {
+        mix = __atomic_load_n(&(dispatchMix[buf->id]), __ATOMIC_ACQUIRE);
+        strand = &(mix[buf->data[0]]);
+        home = buf->id + buf->data[0];
+    }
+    __atomic_fetch_add(&(dispatchPending[buf->id]), 1, __ATOMIC_SEQ_CST);
+
+    buf->next = NULL;
+    buf->queuedNs = IscTimeNowNs();
+    IscMutexLock(&(strand->mutex));
+    if (strand->tail != NULL) {
+        strand->tail->next = buf;
+    } else {
+        strand->head = buf;
+    }
+    strand->tail = buf;
+    push = !strand->scheduled;
+    strand->scheduled = 1;
+    IscMutexUnlock(&(strand->mutex));
+
+    if (push) {
+        IscDispatchPush(&(dispatchWorker[home % dispatchWorkers]), strand);
+    }
+}
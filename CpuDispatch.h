@@ -0,0 +1,191 @@
+#ifndef __CPU_DISPATCH_H__
+#define __CPU_DISPATCH_H__
+
+#include "types.h"
+#include "CpuExt.h"
+#include "CpuBuffer.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/* Where the receive callback of a channel id runs */
+#define ISC_DISPATCH_INLINE         0   /*on the read task, the default*/
+#define ISC_DISPATCH_CHANNEL        1   /*on a dispatch worker, in order per id*/
+#define ISC_DISPATCH_MIX            2   /*on a dispatch worker, in order per id and
+                                          mix_id (first payload byte), mix ids run in
+                                          parallel*/
+
+#define ISC_DISPATCH_MAX_WORKERS    8
+#define ISC_DISPATCH_QUEUE_MAX      1024    /*messages of an id waiting before
+                                              its reader is held back*/
+#define ISC_DISPATCH_RUN_BUDGET     32      /*messages a worker runs per strand
+                                              before it lets others in*/
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscDispatchStart
+ *
+ *  DESCRIPTION
+ *      Start workers callback worker threads. Messages of ids not set to
+ *      ISC_DISPATCH_INLINE are then read by the read task and handed over;
+ *      the callbacks of one strand (an id, or a mix_id of it) run one at a
+ *      time in read order, different strands run in parallel. An idle
+ *      worker steals strands queued on a busy one.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_NO_MORE_THREADS  in case a worker cannot be started
+ *          ISC_RESULT_FAILURE          in case workers is 0 or too large,
+ *                                      or the pool already runs
+ *
+ *----------------------------------------------------------------------------*/
+
+IscResult IscDispatchStart(uint8 workers);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscDispatchStop
+ *
+ *  DESCRIPTION
+ *      Run the messages still queued, then stop and join the workers. Read
+ *      tasks call their callbacks inline again afterwards. Not from a
+ *      receive callback.
+ *
+ *  RETURNS
+ *      void
+ *
+ *----------------------------------------------------------------------------*/
+
+void IscDispatchStop(void);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscSetDispatchMode
+ *
+ *  DESCRIPTION
+ *      Choose where the callbacks of id run, ISC_DISPATCH_xxx. Takes effect
+ *      with the next read. Has no effect on an IscRegisterBatchCb callback.
+ *      The first ISC_DISPATCH_MIX of an id allocates its 256 mix strands,
+ *      kept until exit.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_HANDLE   in case the id is invalid
+ *          ISC_RESULT_FAILURE          in case the mode is unknown or no
+ *                                      memory for the mix strands
+ *
+ *----------------------------------------------------------------------------*/
+
+IscResult IscSetDispatchMode(uint8 id, uint8 mode);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscDispatchReset
+ *
+ *  DESCRIPTION
+ *      Put id back to ISC_DISPATCH_INLINE, for IscChannelRemove. Messages
+ *      of id still queued run first, see IscDispatchHold.
+ *
+ *  RETURNS
+ *      void
+ *
+ *----------------------------------------------------------------------------*/
+
+void IscDispatchReset(uint8 id);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscDispatchHold
+ *
+ *  DESCRIPTION
+ *      Called by the read task before each read. The reader of id stops
+ *      while ISC_DISPATCH_QUEUE_MAX of its messages are queued, so a stalled
+ *      consumer leaves data with the peer instead of piling up memory, and
+ *      while messages queued before a mode change or IscDispatchStop are
+ *      still pending, so no later message overtakes them. A worker calls
+ *      IscNotifyReadable once the reader may go on. Nothing waits here,
+ *      a reactor loop keeps serving its other tasks.
+ *
+ *  RETURNS
+ *      1 if the reader must not read now
+ *
+ *----------------------------------------------------------------------------*/
+
+uint8 IscDispatchHold(uint8 id);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscDispatchHeld
+ *
+ *  RETURNS
+ *      1 if the reader of id waits for IscNotifyReadable from a worker
+ *
+ *----------------------------------------------------------------------------*/
+
+uint8 IscDispatchHeld(uint8 id);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscDispatchEnter
+ *
+ *  DESCRIPTION
+ *      Called by the read task after a read: decide once where all messages
+ *      of that read go. Returns the mode the pending messages of id were
+ *      queued in until they ran, the current one afterwards.
+ *
+ *  RETURNS
+ *      1 if the messages go to IscDispatchSubmit, then IscDispatchLeave
+ *      must follow
+ *
+ *----------------------------------------------------------------------------*/
+
+uint8 IscDispatchEnter(uint8 id);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscDispatchLeave
+ *
+ *  DESCRIPTION
+ *      End the IscDispatchEnter of one read.
+ *
+ *  RETURNS
+ *      void
+ *
+ *----------------------------------------------------------------------------*/
+
+void IscDispatchLeave(void);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscDispatchIsWorker
+ *
+ *  RETURNS
+ *      1 when called on a dispatch worker thread, for example from a
+ *      receive callback of an id not in ISC_DISPATCH_INLINE
+ *
+ *----------------------------------------------------------------------------*/
+
+uint8 IscDispatchIsWorker(void);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscDispatchSubmit
+ *
+ *  DESCRIPTION
+ *      Queue buf on its strand, between IscDispatchEnter and
+ *      IscDispatchLeave. Takes over the caller's reference.
+ *
+ *  RETURNS
+ *      void
+ *
+ *----------------------------------------------------------------------------*/
+
+void IscDispatchSubmit(IscBuffer *buf);
+
+#ifdef  __cplusplus
+}
+#endif
+#endif
@@ -1,3 +1,7 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /*sched_setaffinity, CPU_SET*/
+#endif
+
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -6,18 +10,47 @@
 #include <time.h>
 #include <signal.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <sys/prctl.h>
 
 #include "CpuExt.h"
 #include "private.h"
 #include "CpuThread.h"
+#include "CpuChannel.h"
+#include "CpuReactor.h"
+#include "CpuDispatch.h"
+
+#include <errno.h>
+#include <limits.h>
+
+#ifdef ISC_EVENT_FUTEX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#ifdef ISC_HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
 
 static pthread_mutex_t globalMutex = PTHREAD_MUTEX_INITIALIZER;
 
-extern IscThreadEntry* mThreadEntry[ISC_MAX_ID][ISC_MAX_TASK];
-extern IscReceivedMsg mReceiveCb[ISC_MAX_ID];
-extern const ISC_CHANNALE_MATRIX_T ChannelMatrix[ISC_MAX_ID][ISC_MAX_TASK] ;
+extern IscThreadEntry* mThreadEntry[ISC_MAX_CHANNELS][ISC_MAX_TASK];
+extern IscReceivedMsg mReceiveCb[ISC_MAX_CHANNELS];
+
+#ifdef ISC_EVENT_FUTEX
+/* sleep while *addr == val, until the CLOCK_MONOTONIC deadline (NULL: forever) */
+static int IscFutexWait(uint32 *addr, uint32 val, const struct timespec *deadline)
+{
+    return (int) syscall(SYS_futex, addr, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG,
+                         val, deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+static void IscFutexWake(uint32 *addr, int count)
+{
+    (void) syscall(SYS_futex, addr, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, count, NULL, NULL, 0);
+}
+#endif
 /*----------------------------------------------------------------------------*
  *  NAME
  *      IscEventCreate
@@ -37,17 +70,57 @@ IscResult IscEventCreate(IscEventHandle *eventHandle)
         return ISC_RESULT_INVALID_POINTER;
     }
 
+#ifdef ISC_EVENT_FUTEX
+    eventHandle->eventBits = 0;
+    eventHandle->waiters = 0;
+    return ISC_RESULT_SUCCESS;
+#else
+    pthread_condattr_t condattr;
+
+    if (pthread_condattr_init(&condattr) != 0) {
+        return ISC_RESULT_NO_MORE_EVENTS;
+    }
+    /* timed waits use CLOCK_MONOTONIC deadlines */
+    (void) pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+
     if (pthread_mutex_init(&(eventHandle->mutex), NULL) == 0) {
-        if (pthread_cond_init(&(eventHandle->event), NULL) != 0) {
+        if (pthread_cond_init(&(eventHandle->event), &condattr) != 0) {
+            (void) pthread_mutex_destroy(&(eventHandle->mutex));
+            (void) pthread_condattr_destroy(&condattr);
             return ISC_RESULT_NO_MORE_EVENTS;
         }
 
+        (void) pthread_condattr_destroy(&condattr);
         eventHandle->eventBits = 0;
         return ISC_RESULT_SUCCESS;
     }
     else {
+        (void) pthread_condattr_destroy(&condattr);
         return ISC_RESULT_NO_MORE_EVENTS;
     }
+#endif
+}
+
+/* take the bits of mask that satisfy mode, leaving all others pending.
+ * Returns 0 and the current word in *current if the wait must go on. */
+static uint8 IscEventTake(IscEventHandle *eventHandle, uint32 mask, uint8 mode,
+                          uint32 *current, uint32 *taken)
+{
+    uint32 bits = __atomic_load_n(&(eventHandle->eventBits), __ATOMIC_SEQ_CST);
+
+    for (;;) {
+        uint32 hit = bits & mask;
+
+        if ((mode == ISC_EVENT_WAIT_ALL) ? (hit != mask) : (hit == 0)) {
+            *current = bits;
+            return 0;
+        }
+        if (__atomic_compare_exchange_n(&(eventHandle->eventBits), &bits, bits & ~hit, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+            *taken = hit;
+            return 1;
+        }
+    }
 }
 
 /*----------------------------------------------------------------------------*
@@ -55,7 +128,7 @@ IscResult IscEventCreate(IscEventHandle *eventHandle)
  *      IscEventWait
  *
  *  DESCRIPTION
- *      Wait for the event to be set.
+ *      Wait for the event to be set, all pending bits are returned and cleared.
  *
  *  RETURNS
  *      Possible values:
@@ -65,11 +138,61 @@ IscResult IscEventCreate(IscEventHandle *eventHandle)
  *          ISC_RESULT_INVALID_POINTER      in case the eventBits pointer is invalid
  *----------------------------------------------------------------------------*/
 IscResult IscEventWait(IscEventHandle *eventHandle, uint16 timeoutInMs, uint32 *eventBits)
+{
+    return IscEventWaitMask(eventHandle, 0xFFFFFFFF, ISC_EVENT_WAIT_ANY, timeoutInMs, eventBits);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscEventWaitMask
+ *
+ *  DESCRIPTION
+ *      Wait for any or all bits of mask, only those bits are cleared.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS              in case of success
+ *          ISC_RESULT_TIMEOUT              in case of timeout
+ *          ISC_RESULT_INVALID_HANDLE       in case the eventHandle is invalid
+ *          ISC_RESULT_INVALID_POINTER      in case the eventBits pointer is invalid
+ *          ISC_RESULT_FAILURE              in case mask or mode is invalid
+ *----------------------------------------------------------------------------*/
+IscResult IscEventWaitMask(IscEventHandle *eventHandle, uint32 mask, uint8 mode,
+                           uint16 timeoutInMs, uint32 *eventBits)
+{
+    uint64_t deadlineNs = ISC_TIME_INFINITE;
+
+    if (timeoutInMs != ISC_EVENT_WAIT_INFINITE) {
+        deadlineNs = (timeoutInMs == 0) ? 0 : IscTimeNowNs() + (uint64_t) timeoutInMs * 1000000ULL;
+    }
+    return IscEventWaitUntil(eventHandle, mask, mode, deadlineNs, eventBits);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscEventWaitUntil
+ *
+ *  DESCRIPTION
+ *      IscEventWaitMask with an absolute CLOCK_MONOTONIC deadline in ns.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS              in case of success
+ *          ISC_RESULT_TIMEOUT              in case of timeout
+ *          ISC_RESULT_INVALID_HANDLE       in case the eventHandle is invalid
+ *          ISC_RESULT_INVALID_POINTER      in case the eventBits pointer is invalid
+ *          ISC_RESULT_FAILURE              in case mask or mode is invalid
+ *----------------------------------------------------------------------------*/
+IscResult IscEventWaitUntil(IscEventHandle *eventHandle, uint32 mask, uint8 mode,
+                            uint64_t deadlineNs, uint32 *eventBits)
 {
     struct timespec ts;
-    IscResult result;
-    int ret = 0;
-    pthread_condattr_t condattr;
+    uint32 current = 0;
+    uint32 bits = 0;
+    uint8 done;
+    uint8 forever = (deadlineNs == ISC_TIME_INFINITE);
+    uint8 expired;
+
     if (eventHandle == NULL) {
         return ISC_RESULT_INVALID_HANDLE;
     }
@@ -77,48 +200,63 @@ IscResult IscEventWait(IscEventHandle *eventHandle, uint16 timeoutInMs, uint32 *
     if (eventBits == NULL) {
         return ISC_RESULT_INVALID_POINTER;
     }
-    ret = pthread_condattr_init(&condattr);
-    if (ret != 0) {
-	ISCLOGE("thread condattr init error: %d\n", ret);
-	exit(1);
+
+    if ((mask == 0) || (mode > ISC_EVENT_WAIT_ALL)) {
+        return ISC_RESULT_FAILURE;
     }
-    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
 
-    pthread_cond_init(&(eventHandle->event), &(condattr));
-    (void) pthread_mutex_lock(&(eventHandle->mutex));
-    if ((eventHandle->eventBits == 0) && (timeoutInMs != 0)) {
-        int rc = 0;
-        if (timeoutInMs != ISC_EVENT_WAIT_INFINITE) {
-            time_t sec;
+    ts.tv_sec = (time_t) (deadlineNs / 1000000000ULL);
+    ts.tv_nsec = (long) (deadlineNs % 1000000000ULL);
+    expired = !forever && (deadlineNs <= IscTimeNowNs());
 
-            (void) clock_gettime(CLOCK_MONOTONIC, &ts);
-            sec = timeoutInMs / 1000;
-            ts.tv_sec = ts.tv_sec + sec;
-            ts.tv_nsec = ts.tv_nsec + (timeoutInMs - sec * 1000) * 1000000;
+#ifdef ISC_EVENT_FUTEX
+    /* fast path: the bits are pending, take them without a syscall */
+    done = IscEventTake(eventHandle, mask, mode, &current, &bits);
+    while (!done && !expired) {
+        int rc = 0;
 
-            if (ts.tv_nsec >= 1000000000L) {
-                ts.tv_nsec -= 1000000000L;
-                ts.tv_sec++;
+        /* announce the waiter before the last look, IscEventSet checks
+         * waiters after publishing its bits, so one of us sees the other */
+        (void) __atomic_fetch_add(&(eventHandle->waiters), 1, __ATOMIC_SEQ_CST);
+        done = IscEventTake(eventHandle, mask, mode, &current, &bits);
+        if (!done) {
+            /* returns as soon as the word differs from what we looked at */
+            rc = IscFutexWait(&(eventHandle->eventBits), current, forever ? NULL : &ts);
+            if (rc != 0) {
+                rc = errno;
             }
+            done = IscEventTake(eventHandle, mask, mode, &current, &bits);
+        }
+        (void) __atomic_fetch_sub(&(eventHandle->waiters), 1, __ATOMIC_SEQ_CST);
 
-            while (eventHandle->eventBits == 0 && rc == 0) {
+        if (rc == ETIMEDOUT) {
+            break;
+        }
+    }
+#else
+    (void) pthread_mutex_lock(&(eventHandle->mutex));
+    done = IscEventTake(eventHandle, mask, mode, &current, &bits);
+    if (!done && !expired) {
+        int rc = 0;
+        if (!forever) {
+            while (!done && rc == 0) {
                 rc = pthread_cond_timedwait(&(eventHandle->event), &(eventHandle->mutex), &ts);
+                done = IscEventTake(eventHandle, mask, mode, &current, &bits);
             }
         }
         else {
-            while (eventHandle->eventBits == 0 && rc == 0) {
+            while (!done && rc == 0) {
                 rc = pthread_cond_wait(&(eventHandle->event), &(eventHandle->mutex));
+                done = IscEventTake(eventHandle, mask, mode, &current, &bits);
             }
         }
     }
+    (void) pthread_mutex_unlock(&(eventHandle->mutex));
+#endif
 
-    result = (eventHandle->eventBits == 0) ? ISC_RESULT_TIMEOUT : ISC_RESULT_SUCCESS;
     /* Indicate to caller which events were triggered and cleared */
-    *eventBits = eventHandle->eventBits;
-    /* Clear triggered events */
-    eventHandle->eventBits = 0;
-    (void) pthread_mutex_unlock(&(eventHandle->mutex));
-    return result;
+    *eventBits = done ? bits : 0;
+    return done ? ISC_RESULT_SUCCESS : ISC_RESULT_TIMEOUT;
 }
 
 /*----------------------------------------------------------------------------*
@@ -140,10 +278,19 @@ IscResult IscEventSet(IscEventHandle *eventHandle, uint32 eventBits)
         return ISC_RESULT_INVALID_HANDLE;
     }
 
+#ifdef ISC_EVENT_FUTEX
+    /* one atomic OR, the wake syscall only when somebody is parked.
+     * Waiters may look for different bits, so all of them re-check. */
+    (void) __atomic_fetch_or(&(eventHandle->eventBits), eventBits, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&(eventHandle->waiters), __ATOMIC_SEQ_CST) != 0) {
+        IscFutexWake(&(eventHandle->eventBits), INT_MAX);
+    }
+#else
     (void) pthread_mutex_lock(&(eventHandle->mutex));
     eventHandle->eventBits |= eventBits;
-    (void) pthread_cond_signal(&(eventHandle->event));
+    (void) pthread_cond_broadcast(&(eventHandle->event));
     (void) pthread_mutex_unlock(&(eventHandle->mutex));
+#endif
     return ISC_RESULT_SUCCESS;
 }
 
@@ -164,7 +311,12 @@ void IscEventDestroy(IscEventHandle *eventHandle)
         return;
     }
 
+#ifdef ISC_EVENT_FUTEX
+    eventHandle->eventBits = 0;
+#else
     (void) pthread_cond_destroy(&(eventHandle->event));
+    (void) pthread_mutex_destroy(&(eventHandle->mutex));
+#endif
 }
 
 /*----------------------------------------------------------------------------*
@@ -287,6 +439,44 @@ void IscGlobalMutexUnlock(void)
     (void) pthread_mutex_unlock(&globalMutex);
 }
 
+/* handed to IscThreadTrampoline, freed by it */
+typedef struct
+{
+    void (*threadFunction)(void *pointer);
+    void *pointer;
+    uint32 cpuMask;
+    char name[16];           /*PR_SET_NAME limit including the NUL*/
+}IscThreadStart;
+
+/* runs first in the new thread: name and affinity, then the thread function */
+static void *IscThreadTrampoline(void *data)
+{
+    IscThreadStart start = *((IscThreadStart *) data);
+
+    IscFree(data);
+
+    if (start.name[0] != '\0') {
+        prctl(PR_SET_NAME, start.name);
+    }
+    if (start.cpuMask != 0) {
+        cpu_set_t cpus;
+        uint8 cpu;
+
+        CPU_ZERO(&cpus);
+        for (cpu = 0; cpu < 32; cpu++) {
+            if (start.cpuMask & (1U << cpu)) {
+                CPU_SET(cpu, &cpus);
+            }
+        }
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+            ISCLOGE("%s set affinity 0x%x error: %d", start.name, start.cpuMask, errno);
+        }
+    }
+
+    start.threadFunction(start.pointer);
+    return NULL;
+}
+
 /*----------------------------------------------------------------------------*
  *  NAME
  *      IscThreadCreate
@@ -305,41 +495,136 @@ void IscGlobalMutexUnlock(void)
 IscResult IscThreadCreate(void (*threadFunction)(void *pointer), void *pointer,
                           uint32 stackSize, uint16 priority,
                           const int8 *threadName, IscThreadHandle *threadHandle)
+{
+    IscResult result = IscThreadCreateEx(threadFunction, pointer, stackSize, priority, 0,
+                                         threadName, threadHandle);
+
+    if (result == ISC_RESULT_SUCCESS) {
+        (void) pthread_detach(*threadHandle);
+    }
+    return result;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscThreadCreateEx
+ *
+ *  DESCRIPTION
+ *      IscThreadCreate with a CPU affinity mask. Stack size and scheduling
+ *      are set in the attributes before pthread_create. Without the right
+ *      to use SCHED_FIFO the thread is created with the default policy.
+ *      The thread is joinable, see IscThreadJoin.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS           in case of success
+ *          ISC_RESULT_NO_MORE_THREADS   in case of out of thread resources
+ *          ISC_RESULT_INVALID_POINTER   in case one of the supplied pointers is invalid
+ *          ISC_RESULT_FAILURE           otherwise
+ *
+ *----------------------------------------------------------------------------*/
+IscResult IscThreadCreateEx(void (*threadFunction)(void *pointer), void *pointer,
+                            uint32 stackSize, uint16 priority, uint32 cpuMask,
+                            const int8 *threadName, IscThreadHandle *threadHandle)
 {
     int rc;
     pthread_attr_t threadAttr;
-    uint32 stackS = 0;
-
-    priority;
-    threadName;
+    IscThreadStart *start;
 
     if ((threadFunction == NULL) || (threadHandle == NULL)) {
         return ISC_RESULT_INVALID_POINTER;
     }
 
+    start = (IscThreadStart *) IscMalloc(sizeof(IscThreadStart));
+    if (start == NULL) {
+        return ISC_RESULT_NO_MORE_THREADS;
+    }
+    start->threadFunction = threadFunction;
+    start->pointer = pointer;
+    start->cpuMask = cpuMask;
+    start->name[0] = '\0';
+    if (threadName != NULL) {
+        strncpy(start->name, (const char *) threadName, sizeof(start->name) - 1);
+        start->name[sizeof(start->name) - 1] = '\0';
+    }
+
     rc = pthread_attr_init(&threadAttr);
     if (rc != 0) {
         ISCLOGE("thread attr init error: %d\n", rc);
+        IscFree(start);
         return ISC_RESULT_FAILURE;
     }
+    (void) pthread_attr_setdetachstate(&threadAttr, PTHREAD_CREATE_JOINABLE);
 
-    rc = pthread_create(threadHandle, &threadAttr, (void *(*)(void *))threadFunction, pointer);
-    if (rc != 0) {
-        ISCLOGE("thread create error: %d\n", rc);
-        return ISC_RESULT_NO_MORE_THREADS;
-    }
-    else {
-        (void) pthread_detach(*threadHandle);
+    if (stackSize != 0) {
+        if (stackSize < PTHREAD_STACK_MIN) {
+            stackSize = PTHREAD_STACK_MIN;
+        }
         rc = pthread_attr_setstacksize(&threadAttr, stackSize);
         if (rc != 0) {
             ISCLOGE("set stack size error stackSize=0x%x\n", stackSize);
         }
-        else {
-            rc = pthread_attr_getstacksize(&threadAttr, &stackS);
-            if (rc == 0) {
-                ISCLOGI("%s stack size=0x%x\n", __FUNCTION__, stackS);
-            }
+    }
+
+    if (priority != ISC_THREAD_PRIORITY_NORMAL) {
+        struct sched_param param;
+        int prioMin = sched_get_priority_min(SCHED_FIFO);
+        int prioMax = sched_get_priority_max(SCHED_FIFO);
+
+        param.sched_priority = (int) priority;
+        if (param.sched_priority < prioMin) {
+            param.sched_priority = prioMin;
         }
+        if (param.sched_priority > prioMax) {
+            param.sched_priority = prioMax;
+        }
+        (void) pthread_attr_setinheritsched(&threadAttr, PTHREAD_EXPLICIT_SCHED);
+        (void) pthread_attr_setschedpolicy(&threadAttr, SCHED_FIFO);
+        (void) pthread_attr_setschedparam(&threadAttr, &param);
+    }
+
+    rc = pthread_create(threadHandle, &threadAttr, IscThreadTrampoline, start);
+    if ((rc == EPERM) && (priority != ISC_THREAD_PRIORITY_NORMAL)) {
+        ISCLOGI("%s: no right to SCHED_FIFO %d, default policy used", start->name, priority);
+        (void) pthread_attr_setinheritsched(&threadAttr, PTHREAD_INHERIT_SCHED);
+        rc = pthread_create(threadHandle, &threadAttr, IscThreadTrampoline, start);
+    }
+    (void) pthread_attr_destroy(&threadAttr);
+
+    if (rc != 0) {
+        ISCLOGE("thread create error: %d\n", rc);
+        IscFree(start);
+        return ISC_RESULT_NO_MORE_THREADS;
+    }
+    return ISC_RESULT_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscThreadJoin
+ *
+ *  DESCRIPTION
+ *      Wait for a thread from IscThreadCreateEx to return.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS           in case of success
+ *          ISC_RESULT_INVALID_POINTER   in case the threadHandle pointer is invalid
+ *          ISC_RESULT_FAILURE           otherwise
+ *
+ *----------------------------------------------------------------------------*/
+IscResult IscThreadJoin(IscThreadHandle *threadHandle)
+{
+    int rc;
+
+    if (threadHandle == NULL) {
+        return ISC_RESULT_INVALID_POINTER;
+    }
+
+    rc = pthread_join(*threadHandle, NULL);
+    if (rc != 0) {
+        ISCLOGE("thread join error: %d\n", rc);
+        return ISC_RESULT_FAILURE;
     }
     return ISC_RESULT_SUCCESS;
 }
@@ -407,23 +692,74 @@ IscResult IscThreadEqual(IscThreadHandle *threadHandle1, IscThreadHandle *thread
  *
  *----------------------------------------------------------------------------*/
 void IscThreadSleep(uint16 sleepTimeInMs)
+{
+    IscThreadSleepNs((uint64_t) sleepTimeInMs * 1000000ULL);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscThreadSleepNs
+ *
+ *  DESCRIPTION
+ *      Sleep for a given period in ns.
+ *
+ *  RETURNS
+ *      void
+ *
+ *----------------------------------------------------------------------------*/
+void IscThreadSleepNs(uint64_t sleepTimeInNs)
+{
+    IscThreadSleepUntil(IscTimeNowNs() + sleepTimeInNs);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscThreadSleepUntil
+ *
+ *  DESCRIPTION
+ *      Sleep until an absolute CLOCK_MONOTONIC time in ns, signals do not
+ *      cut the sleep short.
+ *
+ *  RETURNS
+ *      void
+ *
+ *----------------------------------------------------------------------------*/
+void IscThreadSleepUntil(uint64_t deadlineNs)
 {
     struct timespec ts;
-    uint16 seconds = (sleepTimeInMs / 1000U);
-    uint32 nanoseconds = (sleepTimeInMs - seconds * 1000U) * 1000000U;
 
-    ts.tv_sec = (time_t) seconds;
-    ts.tv_nsec = (long) nanoseconds;
+    ts.tv_sec = (time_t) (deadlineNs / 1000000000ULL);
+    ts.tv_nsec = (long) (deadlineNs % 1000000000ULL);
 
-    (void) nanosleep(&ts, NULL);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
 }
 
 /*----------------------------------------------------------------------------*
  *  NAME
- *      IscThreadSleep
+ *      IscTimeNowNs
  *
  *  DESCRIPTION
- *      Sleep for a given period.
+ *      Current CLOCK_MONOTONIC time in ns.
+ *
+ *  RETURNS
+ *      uint64_t
+ *
+ *----------------------------------------------------------------------------*/
+uint64_t IscTimeNowNs(void)
+{
+    struct timespec ts;
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscSetTaskName
+ *
+ *  DESCRIPTION
+ *      Name the calling thread after its task in the channel registry.
  *
  *  RETURNS
  *      void
@@ -431,64 +767,21 @@ void IscThreadSleep(uint16 sleepTimeInMs)
  *----------------------------------------------------------------------------*/
 void IscSetTaskName(uint8 id, uint8 task)
 {
-	switch(id){
-	case ISC_FUNC_ID:
-	{
-		if(task)
-			prctl(PR_SET_NAME,"Func_ISCRD");
-		else
-			prctl(PR_SET_NAME,"Func_ISCRWR");
-	}
-	break;
-	case ISC_SYSD_ID:
-	{
-		if(task)
-			prctl(PR_SET_NAME,"Sysd_ISCRD");
-		else
-			prctl(PR_SET_NAME,"Sysd_ISCRWR");
-	}
-	break;
-	case ISC_TSTD_ID:
-			{
-		if(task)
-			prctl(PR_SET_NAME,"Tstd_ISCRD");
-		else
-			prctl(PR_SET_NAME,"Tstd_ISCRWR");
-	}
-	break;
-	case ISC_LOGD_ID:
-	{
-		if(task)
-			prctl(PR_SET_NAME,"Logd_ISCRD");
-		else
-			prctl(PR_SET_NAME,"Logd_ISCRWR");
-	}
-	break;
-	case ISC_HID_ID:
+	const int8* name = NULL;
+	char shortName[16];
+
+	if(id < ISC_MAX_CHANNELS && task < ISC_MAX_TASK)
 	{
-		if(task)
-			prctl(PR_SET_NAME,"Hid_ISCRD");
-		else
-			prctl(PR_SET_NAME,"Hid_ISCRWR");
+		name = ChannelMatrix[id][task].name;
 	}
-	break;
-	case ISC_MIX_ID:
+	if(name == NULL || name[0] == 0)
 	{
-		if(task)
-			prctl(PR_SET_NAME,"Mix_ISCRD");
-		else
-			prctl(PR_SET_NAME,"Mix_ISCRWR");
-	}
-	break;
-	default:
-		{
-		if(task)
-			prctl(PR_SET_NAME,"ISCRD");
-		else
-			prctl(PR_SET_NAME,"ISCRWR");
-		}
-	break;
+		name = (const int8*)(task ? "ISCRD" : "ISCRWR");
 	}
+	/*the kernel keeps 15 characters*/
+	strncpy(shortName, (const char*)name, sizeof(shortName) - 1);
+	shortName[sizeof(shortName) - 1] = 0;
+	prctl(PR_SET_NAME, shortName);
 }
 /* --------------------------------------------------------------------------*/
 /**
@@ -503,42 +796,125 @@ void IscSetTaskName(uint8 id, uint8 task)
 int16_t IscThreadInit(uint8 id, uint8 task)
 {
     uint16 ret = ISC_SUCCESS;
-    if(id < ISC_MAX_ID)
+    if(id < ISC_MAX_CHANNELS)
     {
         /*Write and Read Task*/
         uint8 i = task;
+        uint8 lane;
+        uint32 ch;
+        const int8* name;
+        ISC_CHANNEL_CONFIG_T cfg;
+        IscChannelInit();
         for(i = ISC_WR_TASK; i < ISC_MAX_TASK; i++)
         {
-		if(ChannelMatrix[id][i].ch == INVALID_CHANNEL)
+            /*IscChannelAdd/Remove/SetConfig change the row only while the id
+              has no tasks: look at it and publish the task in one go*/
+            IscGlobalMutexLock();
+		ch = ChannelMatrix[id][i].ch;
+		if(ch == INVALID_CHANNEL)
 		{
+			IscGlobalMutexUnlock();
 			ISCLOGT("%s:ch:%d,%d is invaild",__func__,id,i);
 			continue;
 		}
-            mThreadEntry[id][i] = (IscThreadEntry*)IscMalloc(sizeof(IscThreadEntry));
-            if(mThreadEntry[id][i] != NULL)
+		if(mThreadEntry[id][i] != NULL)
+		{
+			IscGlobalMutexUnlock();
+			ISCLOGE("%s:id %d task %d is running, deinit it first",__func__,id,i);
+			ret = ISC_ERR_DINVAL;
+			continue;
+		}
+            cfg = ChannelConfig[id][i];
+            name = ChannelMatrix[id][i].name;
+            IscThreadEntry* task = (IscThreadEntry*)IscMalloc(sizeof(IscThreadEntry));
+            if(task != NULL)
             {
-		  mThreadEntry[id][i]->instanceData = NULL;
-		  mThreadEntry[id][i]->mQueueFirst = NULL;
-		  mThreadEntry[id][i]->mQueueLast = NULL;
-                IscThreadEntry* task = mThreadEntry[id][i];
+		  memset(task, 0, sizeof(IscThreadEntry));
                 /*save id*/
                 task->id = id;
+                task->readyFd = -1;
+                task->wakeFd = -1;
+                /*channels read without waiting keep their own thread*/
+                uint8 inReactor = (IscGetThreadMode() == ISC_THREAD_MODE_REACTOR) && \
+                                  !((i == ISC_RD_TASK) && (ch > ISC_MAX_NORMAL_CHANNEL));
+#ifdef ISC_HAVE_EVENTFD
+                if(inReactor || \
+                   ((i == ISC_RD_TASK) && (cfg.readyMode == ISC_READY_FD)))
+                {
+                    task->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                    if(task->wakeFd < 0)
+                    {
+                        ISCLOGE("%s create wake fd error id %d, exit by polling", __func__,id);
+                    }
+                }
+#endif
+                /*write queue create, one ring per lane sharing queueCapacity*/
+                lane = 0;
+                while((i == ISC_WR_TASK) && (lane < ISC_PRIO_LANES) && \
+                      !IscRingCreate(&(task->mQueue[lane]), ISC_LANE_CAPACITY(cfg.queueCapacity, lane)))
+                {
+                    lane++;
+                }
+                if((i == ISC_WR_TASK) && (lane < ISC_PRIO_LANES))
+                {
+                    ISCLOGE("%s create queue error id %d index i %d", __func__,id, i);
+                    while(lane > 0)
+                    {
+                        IscRingDestroy(&(task->mQueue[--lane]));
+                    }
+                    IscFree(task);
+                    IscGlobalMutexUnlock();
+                    ret = ISC_ERR_ALLOC;
+                    continue;
+                }
+                if((i == ISC_WR_TASK) && (cfg.batchBytes != 0))
+                {
+                    task->batchBuf = (uint8*)IscMalloc(cfg.batchBytes);
+                    if(task->batchBuf == NULL)
+                    {
+                        ISCLOGE("%s no batch buffer id %d, batching off", __func__,id);
+                    }
+                }
                 /*event  create*/
                 if(IscEventCreate(&(task->handle)))
                 {
                     ISCLOGE("%s create event error id %d index i %d", __func__,id, i);
                 }
+                if((i == ISC_WR_TASK) && IscEventCreate(&(task->spaceHandle)))
+                {
+                    ISCLOGE("%s create space event error id %d", __func__,id);
+                }
+                if((i == ISC_RD_TASK) && IscEventCreate(&(task->doneHandle)))
+                {
+                    ISCLOGE("%s create done event error id %d", __func__,id);
+                }
 		if(IscMutexCreate(&(task->mMutex)))
 		{
 			ISCLOGE("%s create mutex error id: %d, index i:%d",__func__,id,i);
 		}
+                /*busy until the write task parks itself, senders before that
+                  need not wake it: it looks at the queue when it parks*/
+                task->writerIdle = ISC_WRITER_BUSY;
+                /*complete, senders may use it from now on*/
+                task->inReactor = inReactor;
+                __atomic_store_n(&(mThreadEntry[id][i]), task, __ATOMIC_SEQ_CST);
+                IscGlobalMutexUnlock();
+                if(inReactor)
+                {
+                    if(IscReactorAdd(task, i) != ISC_RESULT_SUCCESS)
+                    {
+                        ISCLOGE("%s add to reactor error id %d index i %d", __func__,id, i);
+                        ret = ISC_ERR_DSYSTEM;
+                    }
+                    continue;
+                }
                 /*thread create*/
                 if(i == ISC_WR_TASK)
                 {
                     /*Write task*/
-                    if(IscThreadCreate(IscAsyncWriteTaskLoop, \
-                                task, ISC_DEFAULT_STACK_SIZE,0, \
-                                ChannelMatrix[id][i].name, \
+                    if(IscThreadCreateEx(IscAsyncWriteTaskLoop, \
+                                task, ISC_DEFAULT_STACK_SIZE, \
+                                cfg.threadPriority, cfg.cpuMask, name, \
                                 &(task->mThreadHandle) ) != ISC_RESULT_SUCCESS)
                     {
                         ISCLOGE("%s create Write thread error id %d index i %d", __func__,id, i);
@@ -546,14 +922,15 @@ int16_t IscThreadInit(uint8 id, uint8 task)
                     }
                     else
                     {
+                        task->joinable = 1;
                         ISCLOGI("%s: write task create %d success", __func__, id);
                     }
                 }else
                 {
                     /*Read task*/
-                    if(IscThreadCreate(IscAsyncReadTaskLoop, \
-                                task,ISC_DEFAULT_STACK_SIZE, 0,\
-                                ChannelMatrix[id][i].name, \
+                    if(IscThreadCreateEx(IscAsyncReadTaskLoop, \
+                                task, ISC_DEFAULT_STACK_SIZE, \
+                                cfg.threadPriority, cfg.cpuMask, name, \
                                 &(task->mThreadHandle) ) != ISC_RESULT_SUCCESS)
                     {
                         ISCLOGE("%s create Read thread error id %d index i %d",__func__, id, i);
@@ -561,27 +938,179 @@ int16_t IscThreadInit(uint8 id, uint8 task)
                     }
                     else
                     {
+                        task->joinable = 1;
                         ISCLOGI("%s: read task create %d success", __func__, id);
                     }
                 }
             }
+            else
+            {
+                IscGlobalMutexUnlock();
+            }
         }
     }
     return  ret;
 }
 
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  release a task entry whose thread is gone
+ *
+ * @param entry
+ * @param taskType  ISC_WR_TASK or ISC_RD_TASK
+ */
+/* ----------------------------------------------------------------------------*/
+void IscTaskEntryFree(IscThreadEntry* entry, uint8 taskType)
+{
+    uint8 lane;
+
+    if(taskType == ISC_WR_TASK)
+    {
+        /*writer never started, or gave up flushing: drop the rest*/
+        IscWriteDiscard(entry);
+        for(lane = 0; lane < ISC_PRIO_LANES; lane++)
+        {
+            IscRingDestroy(&(entry->mQueue[lane]));
+        }
+        IscEventDestroy(&(entry->spaceHandle));
+        if(entry->batchBuf != NULL)
+        {
+            IscFree(entry->batchBuf);
+        }
+    }
+    else
+    {
+        IscEventDestroy(&(entry->doneHandle));
+    }
+#ifdef ISC_HAVE_EVENTFD
+    if(entry->wakeFd >= 0)
+    {
+        close(entry->wakeFd);
+    }
+#endif
+    IscEventDestroy(&(entry->handle));
+    IscMutexDestroy(&(entry->mMutex));
+    IscFree(entry);
+}
+
 int16_t IscThreadDeinit(uint8 id)
 {
- 	uint8 i ;
-        for(i = ISC_WR_TASK; i < ISC_MAX_TASK; i++)
+    return IscThreadDeinitEx(id, ISC_DEINIT_DRAIN_MS);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscThreadDeinitEx
+ *
+ *  DESCRIPTION
+ *      Stop both tasks of id and free them. New sends fail from the start,
+ *      blocked senders give up, the writer flushes its queue for up to
+ *      drainMs and discards the rest. Returns once no thread can touch the
+ *      tasks any more, the id may be initialised again right away. A
+ *      reader blocked in a channel above ISC_MAX_NORMAL_CHANNEL is
+ *      interrupted through IscSetReadUnblock; without that hook it gets
+ *      ISC_DEINIT_READ_WAIT_MS to return by itself. If it does not, its
+ *      task stays registered as closing, the id cannot be initialised
+ *      again and the message it is reading may still be delivered; call
+ *      again later to finish. Removing the last reactor task also stops
+ *      the reactor loop threads.
+ *
+ *  RETURNS
+ *      ISC_SUCCESS, ISC_ERR_DINVAL for a bad id or when called from a
+ *      task or callback of the ISC layer itself, ISC_ERR_TIMEOUT when the
+ *      reader is still blocked in the driver
+ *
+ *----------------------------------------------------------------------------*/
+int16_t IscThreadDeinitEx(uint8 id, uint32 drainMs)
+{
+    IscThreadEntry* task[ISC_MAX_TASK];
+    IscThreadHandle self;
+    int16_t ret = ISC_SUCCESS;
+    uint32 eventBits;
+    uint8 reactor = 0;
+    uint8 i;
+
+    if(id >= ISC_MAX_CHANNELS)
+        return ISC_ERR_DINVAL;
+
+    /*a held reader of any id may wait for this worker's callback to end*/
+    if(IscDispatchIsWorker())
+    {
+        ISCLOGE("%s id %d called from a dispatch worker", __func__, id);
+        return ISC_ERR_DINVAL;
+    }
+    /*joining itself or waiting for its own loop would never return*/
+    (void) IscThreadGetHandle(&self);
+    for(i = ISC_WR_TASK; i < ISC_MAX_TASK; i++)
+    {
+        IscThreadEntry* entry = mThreadEntry[id][i];
+        if(entry != NULL && \
+           ((entry->inReactor && IscReactorIsLoopThread()) || \
+            (entry->joinable && IscThreadEqual(&self, &(entry->mThreadHandle)) == ISC_RESULT_SUCCESS)))
         {
-        	IscThreadEntry* task = mThreadEntry[id][i];
-		if(task != NULL)
-		{
-			IscexitThread(task);
-			IscEventDestroy(&(task->handle));
-			IscMutexDestroy(&(task->mMutex));
-		}
+            ISCLOGE("%s id %d called from its own task", __func__, id);
+            return ISC_ERR_DINVAL;
         }
-    return 0;
+    }
+
+    /*unpublish, then wait for senders and notifiers still using the tasks*/
+    for(i = ISC_WR_TASK; i < ISC_MAX_TASK; i++)
+    {
+        task[i] = __atomic_exchange_n(&(mThreadEntry[id][i]), NULL, __ATOMIC_SEQ_CST);
+        if(task[i] != NULL)
+        {
+            __atomic_store_n(&(task[i]->closing), 1, __ATOMIC_SEQ_CST);
+        }
+    }
+    IscTaskWaitUnused(id, task[ISC_WR_TASK]);
+
+    for(i = ISC_WR_TASK; i < ISC_MAX_TASK; i++)
+    {
+        if(task[i] == NULL)
+            continue;
+        if(i == ISC_WR_TASK && drainMs != 0)
+        {
+            task[i]->drainUntilNs = IscTimeNowNs() + (uint64_t)drainMs * 1000000ULL;
+        }
+        if(task[i]->inReactor)
+        {
+            (void) IscReactorDel(task[i], i);
+            reactor = 1;
+        }
+        else if(task[i]->joinable)
+        {
+            IscThreadHandle thread = task[i]->mThreadHandle;
+            uint32 channel = ChannelMatrix[id][i].ch;
+
+            IscexitThread(task[i]);
+            /*a read blocked in the driver only sees the exit event once it
+              returns: have the backend interrupt it, or if it cannot, give
+              it a while and keep the entry, still closing, if it stays*/
+            if((i == ISC_RD_TASK) && (channel > ISC_MAX_NORMAL_CHANNEL) && \
+               !IscUnblockRead(channel) && \
+               IscEventWait(&(task[i]->doneHandle), ISC_DEINIT_READ_WAIT_MS, &eventBits) != ISC_RESULT_SUCCESS)
+            {
+                ISCLOGE("%s id %d reader blocked in channel %u, not stopped", __func__, id, channel);
+                __atomic_store_n(&(mThreadEntry[id][i]), task[i], __ATOMIC_SEQ_CST);
+                task[i] = NULL;
+                ret = ISC_ERR_TIMEOUT;
+                continue;
+            }
+            (void) IscThreadJoin(&thread);
+        }
+    }
+
+    for(i = ISC_WR_TASK; i < ISC_MAX_TASK; i++)
+    {
+        if(task[i] != NULL)
+        {
+            IscTaskEntryFree(task[i], i);
+        }
+    }
+    /*last reactor task gone: stop the loop threads, busy otherwise*/
+    if(reactor)
+    {
+        (void) IscReactorStop();
+    }
+    return ret;
 }
@@ -18,17 +18,38 @@ typedef uint16 IscResult;
 #define ISC_RESULT_TIMEOUT           ((IscResult) 0x0005)
 #define ISC_RESULT_NO_MORE_THREADS   ((IscResult) 0x0006)
 #define ISC_RESULT_NO_MORE_TIMERS    ((IscResult) 0x0007)
+#define ISC_RESULT_ALREADY_EXISTS    ((IscResult) 0x0008)
 
 #define ISC_EVENT_WAIT_INFINITE         ((uint16) 0xFFFF)
 
+/* IscThreadCreate priority of a time sharing thread, 1..99 is SCHED_FIFO */
+#define ISC_THREAD_PRIORITY_NORMAL      ((uint16) 0)
+
+/* no deadline for IscEventWaitUntil */
+#define ISC_TIME_INFINITE               ((uint64_t) 0xFFFFFFFFFFFFFFFFULL)
+
+/* IscEventWaitMask modes */
+#define ISC_EVENT_WAIT_ANY              ((uint8) 0)
+#define ISC_EVENT_WAIT_ALL              ((uint8) 1)
+
 typedef pthread_mutex_t IscMutexHandle;
 typedef pthread_t IscThreadHandle;
 
+/* Linux events are an atomic bit word plus futex, others use a condvar */
+#if defined(__linux__) && !defined(ISC_NO_FUTEX)
+#define ISC_EVENT_FUTEX 1
+#endif
+
 typedef struct IscEvent
 {
+#ifdef ISC_EVENT_FUTEX
+    uint32 eventBits;       /*futex word*/
+    uint32 waiters;         /*threads parked or about to park*/
+#else
     pthread_cond_t event;
     pthread_mutex_t mutex;
     uint32 eventBits;
+#endif
 }IscEventHandle;
 
 /*----------------------------------------------------------------------------*
@@ -55,7 +76,9 @@ IscResult IscEventCreate(IscEventHandle *eventHandle);
  *  DESCRIPTION
  *      Wait for one or more of the event bits to be set.
  *      It is not possible to pass a bit mask in eventBits
- *      to wait for -- eventBits is an output variable only.
+ *      to wait for -- eventBits is an output variable only,
+ *      use IscEventWaitMask for that. All pending bits are
+ *      cleared on return.
  *      If the wait times out before any events are signalled,
  *      the eventBits variable is zeroed.
  *
@@ -70,6 +93,54 @@ IscResult IscEventCreate(IscEventHandle *eventHandle);
 
 IscResult IscEventWait(IscEventHandle *eventHandle, uint16 timeoutInMs, uint32 *eventBits);
 
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscEventWaitMask
+ *
+ *  DESCRIPTION
+ *      Wait until any (ISC_EVENT_WAIT_ANY) or all (ISC_EVENT_WAIT_ALL)
+ *      of the bits in mask are set. Only the bits of mask that are
+ *      returned in eventBits are cleared, bits outside mask stay
+ *      pending for other waiters, so several consumers may share
+ *      one event.
+ *      If the wait times out, nothing is cleared and the eventBits
+ *      variable is zeroed.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS              in case of success
+ *          ISC_RESULT_TIMEOUT              in case of timeout
+ *          ISC_RESULT_INVALID_HANDLE       in case the eventHandle is invalid
+ *          ISC_RESULT_INVALID_POINTER      in case the eventBits pointer is invalid
+ *          ISC_RESULT_FAILURE              in case mask is 0 or mode is invalid
+ *
+ *----------------------------------------------------------------------------*/
+
+IscResult IscEventWaitMask(IscEventHandle *eventHandle, uint32 mask, uint8 mode,
+                           uint16 timeoutInMs, uint32 *eventBits);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscEventWaitUntil
+ *
+ *  DESCRIPTION
+ *      Same as IscEventWaitMask, but waits until deadlineNs, an absolute
+ *      time on the IscTimeNowNs clock. ISC_TIME_INFINITE waits forever,
+ *      a deadline in the past only checks the pending bits.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS              in case of success
+ *          ISC_RESULT_TIMEOUT              in case of timeout
+ *          ISC_RESULT_INVALID_HANDLE       in case the eventHandle is invalid
+ *          ISC_RESULT_INVALID_POINTER      in case the eventBits pointer is invalid
+ *          ISC_RESULT_FAILURE              in case mask is 0 or mode is invalid
+ *
+ *----------------------------------------------------------------------------*/
+
+IscResult IscEventWaitUntil(IscEventHandle *eventHandle, uint32 mask, uint8 mode,
+                            uint64_t deadlineNs, uint32 *eventBits);
+
 /*----------------------------------------------------------------------------*
  *  NAME
  *      IscEventSet
@@ -196,6 +267,7 @@ void IscGlobalMutexUnlock(void);
  *
  *  DESCRIPTION
  *      Create thread function and return a handle to the created thread.
+ *      The thread runs detached and is named threadName.
  *
  *  RETURNS
  *      Possible values:
@@ -209,6 +281,49 @@ IscResult IscThreadCreate(void (*threadFunction)(void *pointer), void *pointer,
                           uint32 stackSize, uint16 priority,
                           const int8 *threadName, IscThreadHandle *threadHandle);
 
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscThreadCreateEx
+ *
+ *  DESCRIPTION
+ *      IscThreadCreate with a CPU affinity mask (bit n: CPU n, 0 runs on
+ *      any CPU). priority ISC_THREAD_PRIORITY_NORMAL keeps the default
+ *      policy, 1..99 asks for SCHED_FIFO at that priority, clamped to the
+ *      range of the system; without the right to it the default policy is
+ *      used. threadName is cut to 15 characters. Unlike IscThreadCreate
+ *      the thread is joinable and must be reaped with IscThreadJoin.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS           in case of success
+ *          ISC_RESULT_NO_MORE_THREADS   in case of out of thread resources
+ *          ISC_RESULT_INVALID_POINTER   in case one of the supplied pointers is invalid
+ *          ISC_RESULT_FAILURE           otherwise
+ *
+ *----------------------------------------------------------------------------*/
+
+IscResult IscThreadCreateEx(void (*threadFunction)(void *pointer), void *pointer,
+                            uint32 stackSize, uint16 priority, uint32 cpuMask,
+                            const int8 *threadName, IscThreadHandle *threadHandle);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscThreadJoin
+ *
+ *  DESCRIPTION
+ *      Wait for a thread from IscThreadCreateEx to return and release it.
+ *      Must not be called by the thread itself.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS           in case of success
+ *          ISC_RESULT_INVALID_POINTER   in case the threadHandle pointer is invalid
+ *          ISC_RESULT_FAILURE           otherwise
+ *
+ *----------------------------------------------------------------------------*/
+
+IscResult IscThreadJoin(IscThreadHandle *threadHandle);
+
 /*----------------------------------------------------------------------------*
  *  NAME
  *      IscThreadGetHandle
@@ -256,6 +371,49 @@ IscResult IscThreadEqual(IscThreadHandle *threadHandle1, IscThreadHandle *thread
 
 void IscThreadSleep(uint16 sleepTimeInMs);
 
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscThreadSleepNs
+ *
+ *  DESCRIPTION
+ *      Sleep for a given period in ns.
+ *
+ *  RETURNS
+ *      void
+ *
+ *----------------------------------------------------------------------------*/
+
+void IscThreadSleepNs(uint64_t sleepTimeInNs);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscThreadSleepUntil
+ *
+ *  DESCRIPTION
+ *      Sleep until deadlineNs, an absolute time on the IscTimeNowNs clock.
+ *
+ *  RETURNS
+ *      void
+ *
+ *----------------------------------------------------------------------------*/
+
+void IscThreadSleepUntil(uint64_t deadlineNs);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscTimeNowNs
+ *
+ *  DESCRIPTION
+ *      Current time of the CLOCK_MONOTONIC clock in ns, the time base of
+ *      all deadlines.
+ *
+ *  RETURNS
+ *      uint64_t
+ *
+ *----------------------------------------------------------------------------*/
+
+uint64_t IscTimeNowNs(void);
+
 void IscSetTaskName(uint8 id, uint8 task);
 
 #ifdef __cplusplus
@@ -0,0 +1,233 @@
+#ifdef ISC_LOOPBACK
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "isc.h"
+#include "CpuExt.h"
+#include "private.h"
+#include "CpuIf.h"
+#include "CpuThread.h"
+#include "CpuChannel.h"
+#include "CpuRing.h"
+#include "CpuLoopback.h"
+
+
+/* reads of channels above ISC_MAX_NORMAL_CHANNEL block like the driver's */
+#define ISC_LOOPBACK_DATA_EVENT     0x00000001
+#define ISC_LOOPBACK_UNBLOCK_EVENT  0x00000002
+
+static IscMsgRing loopRing[ISC_MAX_CHANNELS];
+static IscEventHandle loopWait[ISC_MAX_CHANNELS];   /*blocking reads sleep here*/
+static uint8 loopFull[ISC_MAX_CHANNELS];      /*a write was refused, tell the writer on the next read*/
+static ISC_LOOPBACK_CONFIG_T loopConfig;
+static uint8 loopReady = 0;
+static uint32 loopWrites = 0;
+static uint32 loopNomem = 0;
+
+/* id whose channel of the given task is channel, ISC_MAX_CHANNELS if none */
+static uint8 IscLoopbackFind(uint32 channel, uint8 task)
+{
+    uint8 id;
+
+    if (channel == INVALID_CHANNEL) {
+        return ISC_MAX_CHANNELS;
+    }
+    for (id = 0; id < ISC_MAX_CHANNELS; id++) {
+        if (ChannelMatrix[id][task].ch == channel) {
+            break;
+        }
+    }
+    return id;
+}
+
+/* IscSetReadUnblock hook: a blocked IscSRead of channel returns 0 */
+static void IscLoopbackUnblock(uint32 channel)
+{
+    uint8 id = IscLoopbackFind(channel, ISC_RD_TASK);
+
+    if ((id < ISC_MAX_CHANNELS) && __atomic_load_n(&loopReady, __ATOMIC_ACQUIRE)) {
+        (void) IscEventSet(&(loopWait[id]), ISC_LOOPBACK_UNBLOCK_EVENT);
+    }
+}
+
+static void IscLoopbackDrop(uint8 id)
+{
+    uint8 *message = NULL;
+    uint16 length = 0;
+
+    while (IscRingPop(&(loopRing[id]), &message, &length, NULL) == ISC_RESULT_SUCCESS) {
+        IscFree(message);
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscLoopbackInit
+ *
+ *  DESCRIPTION
+ *      Create the loopback channels.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_POINTER  in case the config pointer is invalid
+ *          ISC_RESULT_FAILURE          in case a channel cannot be allocated
+ *----------------------------------------------------------------------------*/
+IscResult IscLoopbackInit(const ISC_LOOPBACK_CONFIG_T *config)
+{
+    uint8 id;
+
+    if (config == NULL) {
+        return ISC_RESULT_INVALID_POINTER;
+    }
+    IscLoopbackDeinit();
+    IscChannelInit();
+
+    loopConfig = *config;
+    if (loopConfig.capacity == 0) {
+        loopConfig.capacity = ISC_LOOPBACK_CAPACITY;
+    }
+    for (id = 0; id < ISC_MAX_CHANNELS; id++) {
+        if (IscRingCreate(&(loopRing[id]), loopConfig.capacity) != ISC_RESULT_SUCCESS) {
+            while (id > 0) {
+                IscRingDestroy(&(loopRing[--id]));
+                IscEventDestroy(&(loopWait[id]));
+            }
+            return ISC_RESULT_FAILURE;
+        }
+        (void) IscEventCreate(&(loopWait[id]));
+        loopFull[id] = 0;
+    }
+    __atomic_store_n(&loopWrites, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&loopNomem, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&loopReady, 1, __ATOMIC_RELEASE);
+    IscSetReadUnblock(IscLoopbackUnblock);
+    return ISC_RESULT_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscLoopbackDeinit
+ *
+ *  DESCRIPTION
+ *      Free the loopback channels and the messages still in flight.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscLoopbackDeinit(void)
+{
+    uint8 id;
+
+    if (!__atomic_exchange_n(&loopReady, 0, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    IscSetReadUnblock(NULL);
+    for (id = 0; id < ISC_MAX_CHANNELS; id++) {
+        IscLoopbackDrop(id);
+        IscRingDestroy(&(loopRing[id]));
+        IscEventDestroy(&(loopWait[id]));
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscLoopbackNomemCount
+ *
+ *  DESCRIPTION
+ *      Number of IscWrite calls answered with ISC_ERR_NOMEM.
+ *
+ *  RETURNS
+ *      count since IscLoopbackInit
+ *----------------------------------------------------------------------------*/
+uint32 IscLoopbackNomemCount(void)
+{
+    return __atomic_load_n(&loopNomem, __ATOMIC_RELAXED);
+}
+
+/* driver entry points, same contract as the shared memory driver */
+
+int16 IscWrite(uint32 channel, uint8 *buf, uint16 len)
+{
+    uint8 id = IscLoopbackFind(channel, ISC_WR_TASK);
+    uint32 count;
+    uint8 *copy;
+
+    if ((id >= ISC_MAX_CHANNELS) || !__atomic_load_n(&loopReady, __ATOMIC_ACQUIRE)) {
+        return ISC_INVALID_CHANNEL;
+    }
+    if ((buf == NULL) || (len == 0)) {
+        return ISC_ERR_DINVAL;
+    }
+
+    count = __atomic_add_fetch(&loopWrites, 1, __ATOMIC_RELAXED);
+    if ((loopConfig.nomemEvery != 0) && ((count % loopConfig.nomemEvery) == 0)) {
+        __atomic_fetch_add(&loopNomem, 1, __ATOMIC_RELAXED);
+        return ISC_ERR_NOMEM;
+    }
+
+    copy = (uint8 *) IscMalloc(len);
+    if (copy == NULL) {
+        return ISC_ERR_ALLOC;
+    }
+    memcpy(copy, buf, len);
+    if (IscRingPush(&(loopRing[id]), copy, len,
+                    IscTimeNowNs() + (uint64_t) loopConfig.latencyUs * 1000) != ISC_RESULT_SUCCESS) {
+        IscFree(copy);
+        __atomic_store_n(&(loopFull[id]), 1, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&loopNomem, 1, __ATOMIC_RELAXED);
+        return ISC_ERR_NOMEM;
+    }
+
+    if (ChannelMatrix[id][ISC_RD_TASK].ch > ISC_MAX_NORMAL_CHANNEL) {
+        (void) IscEventSet(&(loopWait[id]), ISC_LOOPBACK_DATA_EVENT);
+    } else if (loopConfig.notify) {
+        IscNotifyReadable(id);
+    }
+    return ISC_SUCCESS;
+}
+
+int16 IscSRead(uint32 channel, uint8 **buf)
+{
+    uint8 id = IscLoopbackFind(channel, ISC_RD_TASK);
+    uint64_t readyNs = 0;
+    uint16 len = 0;
+
+    if (buf == NULL) {
+        return ISC_ERR_DINVAL;
+    }
+    *buf = NULL;
+    if ((id >= ISC_MAX_CHANNELS) || !__atomic_load_n(&loopReady, __ATOMIC_ACQUIRE)) {
+        return ISC_INVALID_CHANNEL;
+    }
+
+    while (IscRingPop(&(loopRing[id]), buf, &len, &readyNs) != ISC_RESULT_SUCCESS) {
+        uint32 eventBits = 0;
+
+        if (channel <= ISC_MAX_NORMAL_CHANNEL) {
+            return 0;
+        }
+        /* blocking channel: sleep until a write, or IscLoopbackUnblock */
+        (void) IscEventWait(&(loopWait[id]), ISC_EVENT_WAIT_INFINITE, &eventBits);
+        if (eventBits & ISC_LOOPBACK_UNBLOCK_EVENT) {
+            return 0;
+        }
+    }
+    /* messages leave in order, so waiting for the head delays no later one */
+    if (readyNs > IscTimeNowNs()) {
+        IscThreadSleepUntil(readyNs);
+    }
+
+    if (__atomic_exchange_n(&(loopFull[id]), 0, __ATOMIC_SEQ_CST) && loopConfig.notify) {
+        IscNotifyWritable(id);
+    }
+    return (int16) len;
+}
+
+int16 IscRead(uint32 channel, uint8 **buf)
+{
+    return IscSRead(channel, buf);
+}
+
+#endif /*ISC_LOOPBACK*/
@@ -0,0 +1,85 @@
+#ifndef __CPU_LOOPBACK_H__
+#define __CPU_LOOPBACK_H__
+
+#include "types.h"
+#include "CpuExt.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/* In-process stand-in for the shared memory driver, built with
+ * ISC_LOOPBACK instead of linking the driver. IscWrite on the write
+ * channel of an id queues a copy that IscRead/IscSRead on the read channel
+ * of the same id return, see ChannelMatrix. Reads of channels above
+ * ISC_MAX_NORMAL_CHANNEL block until a message arrives, as the driver's do,
+ * and are interrupted on deinit through IscSetReadUnblock. */
+
+#define ISC_LOOPBACK_CAPACITY   256     /*default messages in flight per id*/
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  behaviour of the loopback channels, applies to all ids
+ */
+/* ----------------------------------------------------------------------------*/
+typedef struct
+{
+    uint32 capacity;         /*messages in flight per id, IscWrite returns
+                               ISC_ERR_NOMEM when full, 0 for the default*/
+    uint32 latencyUs;        /*a message is readable latencyUs after IscWrite*/
+    uint32 nomemEvery;       /*every nth IscWrite fails with ISC_ERR_NOMEM, 0 never*/
+    uint8 notify;            /*call IscNotifyReadable/IscNotifyWritable*/
+}ISC_LOOPBACK_CONFIG_T;
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscLoopbackInit
+ *
+ *  DESCRIPTION
+ *      Create the loopback channels. Messages still in flight from an
+ *      earlier call are dropped. Call before IscThreadInit.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_POINTER  in case the config pointer is invalid
+ *          ISC_RESULT_FAILURE          in case a channel cannot be allocated
+ *
+ *----------------------------------------------------------------------------*/
+
+IscResult IscLoopbackInit(const ISC_LOOPBACK_CONFIG_T *config);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscLoopbackDeinit
+ *
+ *  DESCRIPTION
+ *      Free the loopback channels and the messages still in flight.
+ *      Call after IscThreadDeinit of all ids.
+ *
+ *  RETURNS
+ *      void
+ *
+ *----------------------------------------------------------------------------*/
+
+void IscLoopbackDeinit(void);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscLoopbackNomemCount
+ *
+ *  DESCRIPTION
+ *      Number of IscWrite calls answered with ISC_ERR_NOMEM, injected or
+ *      because the channel was full.
+ *
+ *  RETURNS
+ *      count since IscLoopbackInit
+ *
+ *----------------------------------------------------------------------------*/
+
+uint32 IscLoopbackNomemCount(void);
+
+#ifdef  __cplusplus
+}
+#endif
+#endif
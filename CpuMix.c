@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "CpuExt.h"
+#include "private.h"
+#include "CpuMix.h"
+
+static IscReceivedMsg mixCb[ISC_MIX_SUB_IDS];
+static IscMixStats mixStats[ISC_MIX_SUB_IDS];
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscRegisterMixCb
+ *
+ *  DESCRIPTION
+ *      Publish cb in the table, the read task picks it up with the next
+ *      message of mixId.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_SUCCESS                 in case of success
+ *          ISC_ERR_DINVAL              in case mixId is 0
+ *----------------------------------------------------------------------------*/
+uint8 IscRegisterMixCb(uint8 mixId, IscReceivedMsg cb)
+{
+    if (mixId == 0) {
+        ISCLOGE("%s, the param is invaild", __func__);
+        return ISC_ERR_DINVAL;
+    }
+    __atomic_store_n(&(mixCb[mixId]), cb, __ATOMIC_RELEASE);
+    ISCLOGT("%s mix_id %d %s", __func__, mixId, (cb != NULL) ? "registered" : "unregistered");
+    return ISC_SUCCESS;
+}
+
+uint8 IscUnRegisterMixCb(uint8 mixId)
+{
+    return IscRegisterMixCb(mixId, NULL);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscMixDeliver
+ *
+ *  DESCRIPTION
+ *      One table load per message, the header is skipped by offset.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscMixDeliver(uint8 *buf, uint16 len, IscReceivedMsg fallback)
+{
+    IscMixStats *st;
+    IscReceivedMsg cb;
+    uint64_t startNs;
+    uint64_t callNs;
+    uint64_t maxNs;
+    uint8 mixId;
+    uint8 hdr;
+
+    /*the sender always puts the mix_id first, a 0 length one has none*/
+    hdr = (len != 0);
+    mixId = hdr ? buf[0] : 0;
+    st = &(mixStats[mixId]);
+    cb = (mixId != 0) ? __atomic_load_n(&(mixCb[mixId]), __ATOMIC_ACQUIRE) : NULL;
+    if ((cb == NULL) && (fallback == NULL)) {
+        __atomic_fetch_add(&(st->unhandled), 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    startNs = IscTimeNowNs();
+    if (cb != NULL) {
+        cb(buf + 1, len - 1);
+    } else if (mixId != 0) {
+        /*sub-channel nobody registered: the default callback demuxes*/
+        fallback(buf, len);
+    } else {
+        fallback(buf + hdr, len - hdr);
+    }
+    callNs = IscTimeNowNs() - startNs;
+
+    if (cb == NULL) {
+        __atomic_fetch_add(&(st->defaulted), 1, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&(st->rxMsgs), 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(st->rxBytes), len - hdr, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(st->callNs), callNs, __ATOMIC_RELAXED);
+    maxNs = __atomic_load_n(&(st->callMaxNs), __ATOMIC_RELAXED);
+    while ((callNs > maxNs) &&
+           !__atomic_compare_exchange_n(&(st->callMaxNs), &maxNs, callNs, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscGetMixStats
+ *
+ *  DESCRIPTION
+ *      Snapshot the counters of mixId.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_POINTER  in case the stats pointer is invalid
+ *----------------------------------------------------------------------------*/
+IscResult IscGetMixStats(uint8 mixId, IscMixStats *stats)
+{
+    IscMixStats *st = &(mixStats[mixId]);
+
+    if (stats == NULL) {
+        return ISC_RESULT_INVALID_POINTER;
+    }
+    stats->rxMsgs = __atomic_load_n(&(st->rxMsgs), __ATOMIC_RELAXED);
+    stats->rxBytes = __atomic_load_n(&(st->rxBytes), __ATOMIC_RELAXED);
+    stats->defaulted = __atomic_load_n(&(st->defaulted), __ATOMIC_RELAXED);
+    stats->unhandled = __atomic_load_n(&(st->unhandled), __ATOMIC_RELAXED);
+    stats->callNs = __atomic_load_n(&(st->callNs), __ATOMIC_RELAXED);
+    stats->callMaxNs = __atomic_load_n(&(st->callMaxNs), __ATOMIC_RELAXED);
+    return ISC_RESULT_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscMixReset
+ *
+ *  DESCRIPTION
+ *      Clear the table and the counters of every mix_id.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscMixReset(void)
+{
+    uint32 mixId;
+
+    for (mixId = 0; mixId < ISC_MIX_SUB_IDS; mixId++) {
+        __atomic_store_n(&(mixCb[mixId]), NULL, __ATOMIC_RELEASE);
+    }
+    memset(mixStats, 0, sizeof(mixStats));
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscMixStatsDump
+ *
+ *  DESCRIPTION
+ *      Log msgs, bytes, defaulted, unhandled and mean/max callback time
+ *      per mix_id.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscMixStatsDump(void)
+{
+    IscMixStats stats;
+    uint32 mixId;
+
+    for (mixId = 0; mixId < ISC_MIX_SUB_IDS; mixId++) {
+        (void) IscGetMixStats((uint8) mixId, &stats);
+        if ((stats.rxMsgs == 0) && (stats.unhandled == 0)) {
+            continue;
+        }
+        ISCLOGI("mix_id %u rx %llu msgs %llu bytes, %u to default, %u unhandled, callback us mean %llu max %llu",
+                mixId, (unsigned long long) stats.rxMsgs, (unsigned long long) stats.rxBytes,
+                stats.defaulted, stats.unhandled,
+                (unsigned long long) ((stats.rxMsgs != 0) ? stats.callNs / stats.rxMsgs / 1000 : 0),
+                (unsigned long long) (stats.callMaxNs / 1000));
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef __CPU_MIX_H__
+#define __CPU_MIX_H__
+
+#include "types.h"
+#include "CpuExt.h"
+#include "isc.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/* every message of ISC_MIX_ID starts with its mix_id byte, 0 for a message
+ * of no sub-channel, so sub-channels are 1..255 */
+#define ISC_MIX_SUB_IDS     256
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  counters of one mix_id on ISC_MIX_ID, see IscGetMixStats
+ */
+/* ----------------------------------------------------------------------------*/
+typedef struct
+{
+    uint64_t rxMsgs;         /*messages of the mix_id delivered to a callback*/
+    uint64_t rxBytes;        /*payload bytes, mix_id header not counted*/
+    uint32 defaulted;        /*of rxMsgs, went to the ISC_MIX_ID callback*/
+    uint32 unhandled;        /*no callback for the mix_id nor for ISC_MIX_ID*/
+    uint64_t callNs;         /*time spent in the callbacks*/
+    uint64_t callMaxNs;
+}IscMixStats;
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscRegisterMixCb
+ *
+ *  DESCRIPTION
+ *      Deliver the messages of ISC_MIX_ID sent with mixId to cb, without
+ *      the mix_id byte. Messages of a mix_id without a callback still go
+ *      to the IscRegisterCb callback of ISC_MIX_ID, header included;
+ *      messages sent with mix_id 0 go there without it. A buffer or batch
+ *      callback on ISC_MIX_ID takes precedence over both and sees the
+ *      header of every message. NULL cb unregisters.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_SUCCESS                 in case of success
+ *          ISC_ERR_DINVAL              in case mixId is 0
+ *
+ *----------------------------------------------------------------------------*/
+
+uint8 IscRegisterMixCb(uint8 mixId, IscReceivedMsg cb);
+uint8 IscUnRegisterMixCb(uint8 mixId);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscMixDeliver
+ *
+ *  DESCRIPTION
+ *      Look the mix_id of a received ISC_MIX_ID message up in the table and
+ *      run its callback on the payload behind the header. Without one the
+ *      whole message goes to fallback, or is counted as unhandled. A
+ *      message of mix_id 0 goes to fallback without its header. Either
+ *      way it is counted under its mix_id.
+ *
+ *  RETURNS
+ *      void
+ *
+ *----------------------------------------------------------------------------*/
+
+void IscMixDeliver(uint8 *buf, uint16 len, IscReceivedMsg fallback);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscGetMixStats
+ *
+ *  DESCRIPTION
+ *      Snapshot the counters of mixId, every field read atomically.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_POINTER  in case the stats pointer is invalid
+ *
+ *----------------------------------------------------------------------------*/
+
+IscResult IscGetMixStats(uint8 mixId, IscMixStats *stats);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscMixReset
+ *
+ *  DESCRIPTION
+ *      Drop every mix_id callback and zero the counters, for IscChannelRemove
+ *      of ISC_MIX_ID.
+ *
+ *  RETURNS
+ *      void
+ *
+ *----------------------------------------------------------------------------*/
+
+void IscMixReset(void);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscMixStatsDump
+ *
+ *  DESCRIPTION
+ *      Log the counters of every mix_id that saw traffic.
+ *
+ *  RETURNS
+ *      void
+ *
+ *----------------------------------------------------------------------------*/
+
+void IscMixStatsDump(void);
+
+#ifdef  __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,326 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "CpuExt.h"
+#include "private.h"
+#include "CpuPool.h"
+#include "CpuChannel.h"
+
+/* header in front of every buffer, payload starts ISC_POOL_HDR_SIZE later */
+typedef struct IscPoolBlockTag
+{
+    struct IscPoolBlockTag *next;   /*free list link while not in use*/
+    uint8 id;
+    uint8 sizeClass;
+    uint32 size;                    /*bytes asked for in IscPoolAlloc*/
+}IscPoolBlock;
+
+#define ISC_POOL_HDR_SIZE   16
+
+typedef struct
+{
+    IscMutexHandle mutex;
+    IscPoolBlock *freeList;
+}IscPoolClass;
+
+typedef struct
+{
+    IscPoolBlock *head;
+    uint16 count;
+}IscPoolCache;
+
+static const uint32 poolClassSize[ISC_POOL_CLASS_NUM] = {64, 256, 1024, 4096};
+
+static IscPoolClass poolClass[ISC_MAX_CHANNELS][ISC_POOL_CLASS_NUM];
+static IscPoolStats poolStats[ISC_MAX_CHANNELS];
+static pthread_once_t poolOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t poolKey;
+
+static __thread IscPoolCache poolCache[ISC_MAX_CHANNELS][ISC_POOL_CLASS_NUM];
+static __thread uint8 poolCacheBound = 0;
+
+typedef char IscPoolHdrCheck[(sizeof(IscPoolBlock) <= ISC_POOL_HDR_SIZE) ? 1 : -1];
+
+static void IscPoolCacheFlush(IscPoolCache *cache, uint8 id, uint8 cls, uint16 keep)
+{
+    IscPoolClass *pc = &(poolClass[id][cls]);
+    IscPoolBlock *first = cache->head;
+    IscPoolBlock *last = NULL;
+    uint16 moved = 0;
+
+    while ((cache->count > keep) && (cache->head != NULL)) {
+        last = cache->head;
+        cache->head = last->next;
+        cache->count--;
+        moved++;
+    }
+    if (moved == 0) {
+        return;
+    }
+
+    IscMutexLock(&(pc->mutex));
+    last->next = pc->freeList;
+    pc->freeList = first;
+    IscMutexUnlock(&(pc->mutex));
+}
+
+/* thread exit: hand the blocks of this thread's cache back to the free lists */
+static void IscPoolThreadExit(void *data)
+{
+    IscPoolCache (*cache)[ISC_POOL_CLASS_NUM] = (IscPoolCache (*)[ISC_POOL_CLASS_NUM]) data;
+    uint8 id;
+    uint8 cls;
+
+    for (id = 0; id < ISC_MAX_CHANNELS; id++) {
+        for (cls = 0; cls < ISC_POOL_CLASS_NUM; cls++) {
+            IscPoolCacheFlush(&(cache[id][cls]), id, cls, 0);
+        }
+    }
+}
+
+static void IscPoolInitOnce(void)
+{
+    uint8 id;
+    uint8 cls;
+
+    for (id = 0; id < ISC_MAX_CHANNELS; id++) {
+        for (cls = 0; cls < ISC_POOL_CLASS_NUM; cls++) {
+            (void) IscMutexCreate(&(poolClass[id][cls].mutex));
+            poolClass[id][cls].freeList = NULL;
+        }
+    }
+    (void) pthread_key_create(&poolKey, IscPoolThreadExit);
+}
+
+static IscPoolCache *IscPoolGetCache(uint8 id, uint8 cls)
+{
+    if (!poolCacheBound) {
+        poolCacheBound = 1;
+        (void) pthread_setspecific(poolKey, poolCache);
+    }
+    return &(poolCache[id][cls]);
+}
+
+static void IscPoolCountAlloc(IscPoolClassStats *st, uint8 hit)
+{
+    uint32 inUse;
+    uint32 high;
+
+    __atomic_fetch_add(&(st->allocs), 1, __ATOMIC_RELAXED);
+    if (hit) {
+        __atomic_fetch_add(&(st->hits), 1, __ATOMIC_RELAXED);
+    }
+    inUse = __atomic_add_fetch(&(st->inUse), 1, __ATOMIC_RELAXED);
+    high = __atomic_load_n(&(st->highWater), __ATOMIC_RELAXED);
+    while ((inUse > high) &&
+           !__atomic_compare_exchange_n(&(st->highWater), &high, inUse, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscPoolAlloc
+ *
+ *  DESCRIPTION
+ *      Allocate a message buffer from the pool of channel id.
+ *
+ *  RETURNS
+ *      pointer to the buffer, NULL in case of out of memory or invalid id
+ *----------------------------------------------------------------------------*/
+void *IscPoolAlloc(uint8 id, uint32 size)
+{
+    IscPoolBlock *blk = NULL;
+    uint8 cls = 0;
+    uint8 hit = 0;
+
+    if (id >= ISC_MAX_CHANNELS) {
+        return NULL;
+    }
+    (void) pthread_once(&poolOnce, IscPoolInitOnce);
+
+    while ((cls < ISC_POOL_CLASS_NUM) && (size > poolClassSize[cls])) {
+        cls++;
+    }
+
+    if (cls < ISC_POOL_CLASS_NUM) {
+        IscPoolCache *cache = IscPoolGetCache(id, cls);
+
+        if (cache->head == NULL) {
+            /* refill half of the cache from the shared free list */
+            IscPoolClass *pc = &(poolClass[id][cls]);
+
+            IscMutexLock(&(pc->mutex));
+            while ((pc->freeList != NULL) && (cache->count < ISC_POOL_CACHE_SIZE / 2)) {
+                IscPoolBlock *b = pc->freeList;
+                pc->freeList = b->next;
+                b->next = cache->head;
+                cache->head = b;
+                cache->count++;
+            }
+            IscMutexUnlock(&(pc->mutex));
+        }
+
+        if (cache->head != NULL) {
+            blk = cache->head;
+            cache->head = blk->next;
+            cache->count--;
+            hit = 1;
+        }
+        else {
+            blk = (IscPoolBlock *) IscMalloc(ISC_POOL_HDR_SIZE + poolClassSize[cls]);
+            if (blk != NULL) {
+                __atomic_fetch_add(&(poolStats[id].cls[cls].blocks), 1, __ATOMIC_RELAXED);
+            }
+        }
+    }
+    else {
+        blk = (IscPoolBlock *) IscMalloc(ISC_POOL_HDR_SIZE + size);
+        if (blk != NULL) {
+            __atomic_fetch_add(&(poolStats[id].cls[cls].blocks), 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    if (blk == NULL) {
+        return NULL;
+    }
+    blk->next = NULL;
+    blk->id = id;
+    blk->sizeClass = cls;
+    blk->size = size;
+    IscPoolCountAlloc(&(poolStats[id].cls[cls]), hit);
+    return (uint8 *) blk + ISC_POOL_HDR_SIZE;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscPoolFree
+ *
+ *  DESCRIPTION
+ *      Return a buffer to the calling thread's cache, spilling half of the
+ *      cache to the shared free list when it is full.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscPoolFree(void *buf)
+{
+    IscPoolBlock *blk;
+    IscPoolCache *cache;
+    uint8 id;
+    uint8 cls;
+
+    if (buf == NULL) {
+        return;
+    }
+
+    blk = (IscPoolBlock *) ((uint8 *) buf - ISC_POOL_HDR_SIZE);
+    id = blk->id;
+    cls = blk->sizeClass;
+    __atomic_fetch_sub(&(poolStats[id].cls[cls].inUse), 1, __ATOMIC_RELAXED);
+
+    if (cls == ISC_POOL_OVERSIZE) {
+        IscFree(blk);
+        return;
+    }
+
+    cache = IscPoolGetCache(id, cls);
+    blk->next = cache->head;
+    cache->head = blk;
+    cache->count++;
+    if (cache->count > ISC_POOL_CACHE_SIZE) {
+        IscPoolCacheFlush(cache, id, cls, ISC_POOL_CACHE_SIZE / 2);
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscPoolGetInfo
+ *
+ *  DESCRIPTION
+ *      Channel id and requested size of a buffer from IscPoolAlloc.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_POINTER  in case a pointer is invalid
+ *----------------------------------------------------------------------------*/
+IscResult IscPoolGetInfo(const void *buf, uint8 *id, uint32 *size)
+{
+    const IscPoolBlock *blk;
+
+    if ((buf == NULL) || (id == NULL) || (size == NULL)) {
+        return ISC_RESULT_INVALID_POINTER;
+    }
+
+    blk = (const IscPoolBlock *) ((const uint8 *) buf - ISC_POOL_HDR_SIZE);
+    *id = blk->id;
+    *size = blk->size;
+    return ISC_RESULT_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscPoolGetStats
+ *
+ *  DESCRIPTION
+ *      Snapshot the pool counters of channel id.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_HANDLE   in case the id is invalid
+ *          ISC_RESULT_INVALID_POINTER  in case the stats pointer is invalid
+ *----------------------------------------------------------------------------*/
+IscResult IscPoolGetStats(uint8 id, IscPoolStats *stats)
+{
+    uint8 cls;
+
+    if (id >= ISC_MAX_CHANNELS) {
+        return ISC_RESULT_INVALID_HANDLE;
+    }
+    if (stats == NULL) {
+        return ISC_RESULT_INVALID_POINTER;
+    }
+
+    for (cls = 0; cls <= ISC_POOL_OVERSIZE; cls++) {
+        IscPoolClassStats *st = &(poolStats[id].cls[cls]);
+
+        stats->cls[cls].allocs = __atomic_load_n(&(st->allocs), __ATOMIC_RELAXED);
+        stats->cls[cls].hits = __atomic_load_n(&(st->hits), __ATOMIC_RELAXED);
+        stats->cls[cls].blocks = __atomic_load_n(&(st->blocks), __ATOMIC_RELAXED);
+        stats->cls[cls].inUse = __atomic_load_n(&(st->inUse), __ATOMIC_RELAXED);
+        stats->cls[cls].highWater = __atomic_load_n(&(st->highWater), __ATOMIC_RELAXED);
+    }
+    return ISC_RESULT_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscPoolDumpStats
+ *
+ *  DESCRIPTION
+ *      Log hit rate and high-water mark of every size class of channel id.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscPoolDumpStats(uint8 id)
+{
+    IscPoolStats stats;
+    uint8 cls;
+
+    if (IscPoolGetStats(id, &stats) != ISC_RESULT_SUCCESS) {
+        return;
+    }
+
+    for (cls = 0; cls <= ISC_POOL_OVERSIZE; cls++) {
+        IscPoolClassStats *st = &(stats.cls[cls]);
+        uint32 rate = (st->allocs != 0) ? (uint32) ((uint64_t) st->hits * 100 / st->allocs) : 0;
+
+        ISCLOGI("pool id %d class %d(%u): allocs %u hit %u%% blocks %u inUse %u high %u",
+                id, cls, (cls < ISC_POOL_CLASS_NUM) ? poolClassSize[cls] : 0,
+                st->allocs, rate, st->blocks, st->inUse, st->highWater);
+    }
+}
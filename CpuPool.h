@@ -0,0 +1,117 @@
+#ifndef __CPU_POOL_H__
+#define __CPU_POOL_H__
+
+#include "types.h"
+#include "CpuExt.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/* Size classes: 64/256/1K/4K, anything larger goes to the oversize class */
+#define ISC_POOL_CLASS_NUM      4
+#define ISC_POOL_OVERSIZE       ISC_POOL_CLASS_NUM
+#define ISC_POOL_CACHE_SIZE     16      /*blocks kept per thread and class*/
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  counters of one size class, all taken with relaxed atomics
+ */
+/* ----------------------------------------------------------------------------*/
+typedef struct
+{
+    uint32 allocs;           /*IscPoolAlloc calls served by this class*/
+    uint32 hits;             /*served from a thread cache or the free list*/
+    uint32 blocks;           /*blocks carved from the heap so far*/
+    uint32 inUse;            /*blocks currently handed out*/
+    uint32 highWater;        /*max of inUse*/
+}IscPoolClassStats;
+
+typedef struct
+{
+    IscPoolClassStats cls[ISC_POOL_CLASS_NUM + 1];   /*last one is oversize*/
+}IscPoolStats;
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscPoolAlloc
+ *
+ *  DESCRIPTION
+ *      Allocate a message buffer of at least size bytes from the pool of
+ *      channel id. The calling thread's cache is tried first, then the
+ *      shared free list of the size class, then the heap.
+ *
+ *  RETURNS
+ *      pointer to the buffer, NULL in case of out of memory or invalid id
+ *
+ *----------------------------------------------------------------------------*/
+
+void *IscPoolAlloc(uint8 id, uint32 size);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscPoolFree
+ *
+ *  DESCRIPTION
+ *      Return a buffer obtained from IscPoolAlloc, may be called from any
+ *      thread. NULL is ignored.
+ *
+ *  RETURNS
+ *      void
+ *
+ *----------------------------------------------------------------------------*/
+
+void IscPoolFree(void *buf);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscPoolGetInfo
+ *
+ *  DESCRIPTION
+ *      Get the channel id and the size asked for of a buffer still held
+ *      from IscPoolAlloc.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_POINTER  in case a pointer is invalid
+ *
+ *----------------------------------------------------------------------------*/
+
+IscResult IscPoolGetInfo(const void *buf, uint8 *id, uint32 *size);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscPoolGetStats
+ *
+ *  DESCRIPTION
+ *      Snapshot the pool counters of channel id.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_HANDLE   in case the id is invalid
+ *          ISC_RESULT_INVALID_POINTER  in case the stats pointer is invalid
+ *
+ *----------------------------------------------------------------------------*/
+
+IscResult IscPoolGetStats(uint8 id, IscPoolStats *stats);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscPoolDumpStats
+ *
+ *  DESCRIPTION
+ *      Log hit rate and high-water mark of every size class of channel id.
+ *
+ *  RETURNS
+ *      void
+ *
+ *----------------------------------------------------------------------------*/
+
+void IscPoolDumpStats(uint8 id);
+
+#ifdef  __cplusplus
+}
+#endif
+#endif
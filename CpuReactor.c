@@ -0,0 +1,553 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/prctl.h>
+
+#include "CpuExt.h"
+#include "private.h"
+#include "CpuThread.h"
+#include "CpuChannel.h"
+#include "CpuReactor.h"
+#include "CpuStats.h"
+
+#ifdef ISC_HAVE_EVENTFD
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+extern IscThreadEntry* mThreadEntry[ISC_MAX_CHANNELS][ISC_MAX_TASK];
+
+static uint8 reactorMode = ISC_THREAD_MODE_TASK;
+
+#ifdef ISC_HAVE_EVENTFD
+
+#define ISC_REACTOR_ITEMS   (ISC_MAX_CHANNELS * ISC_MAX_TASK)
+#define ISC_REACTOR_EVENTS  16
+#define ISC_REACTOR_CTRL    ((uint64_t) -1)   /*epoll tag of the control fd*/
+
+/* epoll tag of a task fd: item index, low bit set for the backend ready fd */
+#define ISC_REACTOR_TAG(index, ready)   ((((uint64_t) (index)) << 1) | (ready))
+
+typedef struct
+{
+    IscThreadEntry *task;    /*NULL while the slot is free*/
+    uint8 taskType;
+    uint32 channel;
+    int readyFd;             /*backend fd registered with epoll, -1 if none*/
+    uint32 pollUs;           /*read task polled every pollUs, 0 if not polled*/
+    uint64_t nextPollNs;
+    uint8 again;             /*read budget ran out, service on next pass*/
+    uint8 exiting;           /*write task flushing until drainUntilNs before removal*/
+    uint8 starting;          /*write task not parked yet, the next poll pass does it*/
+    IscEventHandle gone;     /*ISC_EXIT_EVENT once the loop dropped the task*/
+}IscReactorItem;
+
+typedef struct
+{
+    int epollFd;
+    int ctrlFd;
+    uint8 started;
+    uint8 stopping;          /*IscReactorStop: return on the next control wakeup*/
+    uint8 eventsReady;       /*item events created, kept across restarts*/
+    IscThreadHandle thread;
+    IscReactorItem items[ISC_REACTOR_ITEMS];
+}IscReactorLoop;
+
+static uint8 reactorLoops = 1;
+static IscReactorLoop reactorLoop[ISC_REACTOR_MAX_LOOPS];
+static __thread uint8 reactorSelf = 0;     /*set on the loop threads*/
+
+static void IscReactorRemove(IscReactorLoop *loop, IscReactorItem *item)
+{
+    IscThreadEntry *task = item->task;
+
+    (void) epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, task->wakeFd, NULL);
+    if (item->readyFd >= 0) {
+        (void) epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, item->readyFd, NULL);
+        item->readyFd = -1;
+    }
+    if (item->taskType == ISC_WR_TASK) {
+        IscWriteFlush(task, item->channel);
+    }
+    task->running = 0;
+    ISCLOGT("%s,@@@@@@@@@@@@@@EXIT id:%d task:%d", __func__, task->id, item->taskType);
+    /*last access, IscReactorDel may free the task after this*/
+    __atomic_store_n(&(item->task), NULL, __ATOMIC_RELEASE);
+    IscEventSet(&(item->gone), ISC_EXIT_EVENT);
+}
+
+/* follow IscSetReadyFd: swap the backend fd in epoll, stop polling once set */
+static void IscReactorSyncReadyFd(IscReactorLoop *loop, IscReactorItem *item, uint32 index)
+{
+    IscThreadEntry *task = item->task;
+    int fd = __atomic_load_n(&(task->readyFd), __ATOMIC_ACQUIRE);
+    struct epoll_event ev;
+
+    if ((fd == item->readyFd) ||
+        (ChannelConfig[task->id][ISC_RD_TASK].readyMode != ISC_READY_FD)) {
+        return;
+    }
+
+    if (item->readyFd >= 0) {
+        (void) epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, item->readyFd, NULL);
+    }
+    item->readyFd = -1;
+    item->pollUs = ChannelConfig[task->id][ISC_RD_TASK].pollIntervalUs;
+    if (fd >= 0) {
+        ev.events = EPOLLIN;
+        ev.data.u64 = ISC_REACTOR_TAG(index, 1);
+        if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, fd, &ev) == 0) {
+            item->readyFd = fd;
+            item->pollUs = 0;
+        }
+        else {
+            ISCLOGE("%s id %d cannot watch ready fd %d, polling", __func__, task->id, fd);
+        }
+    }
+}
+
+/* drain the writer, then park it: senders wake it again with ISC_MSG_EVENT */
+static void IscReactorWrite(IscReactorItem *item)
+{
+    IscThreadEntry *task = item->task;
+
+    do {
+        (void) IscWriteDrain(task, item->channel, 0);
+    } while ((task->retryMsg == NULL) && !IscWriterPark(task, ISC_WRITER_IDLE));
+}
+
+static void IscReactorRead(IscReactorItem *item)
+{
+    item->again = IscReadDrain(item->task, item->channel, ISC_REACTOR_READ_BUDGET);
+}
+
+/* the task's wake fd fired: fetch its event bits and run the loop body */
+static void IscReactorService(IscReactorLoop *loop, IscReactorItem *item, uint32 index)
+{
+    IscThreadEntry *task = item->task;
+    uint32 eventBits = 0;
+    uint64_t count;
+
+    /*consume, then re-arm: a wake in between writes again*/
+    (void) read(task->wakeFd, &count, sizeof(count));
+    __atomic_store_n(&(task->wakePending), 0, __ATOMIC_SEQ_CST);
+    (void) IscEventWait(&(task->handle), 0, &eventBits);
+
+    if (eventBits & ISC_EXIT_EVENT) {
+        if ((item->taskType == ISC_WR_TASK) && (task->drainUntilNs != 0)) {
+            /*flush from the poll pass, the loop keeps serving other tasks*/
+            item->exiting = 1;
+            (void) IscWriteDrain(task, item->channel, 0);
+            if ((task->retryMsg == NULL) || (IscTimeNowNs() >= task->drainUntilNs)) {
+                IscReactorRemove(loop, item);
+            }
+            return;
+        }
+        IscReactorRemove(loop, item);
+        return;
+    }
+
+    if (item->taskType == ISC_WR_TASK) {
+        if (eventBits & ISC_TX_EVENT) {
+            task->retryAtNs = 0;
+        }
+        if (eventBits & ISC_WR_EVENTS) {
+            IscStatsWakeup(task->id, (task->retryMsg != NULL) ? ((eventBits & ISC_TX_EVENT) != 0) :
+                                     IscWriterHasWork(task));
+            IscReactorWrite(item);
+        }
+    }
+    else {
+        IscReactorSyncReadyFd(loop, item, index);
+        IscReactorRead(item);
+    }
+}
+
+/* retry held writes and read the polled channels that are due,
+ * return the next epoll timeout */
+static int IscReactorPoll(IscReactorLoop *loop)
+{
+    uint64_t now = IscTimeNowNs();
+    uint64_t next = 0;
+    uint32 i;
+
+    for (i = 0; i < ISC_REACTOR_ITEMS; i++) {
+        IscReactorItem *item = &(loop->items[i]);
+        IscThreadEntry *task = __atomic_load_n(&(item->task), __ATOMIC_ACQUIRE);
+
+        if (task == NULL) {
+            continue;
+        }
+        if (item->taskType == ISC_WR_TASK) {
+            if (item->starting) {
+                /*drain what came in before, then park: senders wake it from now on*/
+                item->starting = 0;
+                IscReactorWrite(item);
+            }
+            if ((task->retryMsg != NULL) && (now >= task->retryAtNs)) {
+                IscReactorWrite(item);
+            }
+            if (item->exiting &&
+                ((task->retryMsg == NULL) || (now >= task->drainUntilNs))) {
+                IscReactorRemove(loop, item);
+                continue;
+            }
+            if ((task->retryMsg != NULL) && ((next == 0) || (task->retryAtNs < next))) {
+                next = task->retryAtNs;
+            }
+            if (item->exiting && (task->drainUntilNs < next)) {
+                next = task->drainUntilNs;
+            }
+            continue;
+        }
+        if (item->again || ((item->pollUs != 0) && (now >= item->nextPollNs))) {
+            IscReactorRead(item);
+            item->nextPollNs = now + (uint64_t) item->pollUs * 1000ULL;
+        }
+        if (item->again) {
+            return 0;
+        }
+        if ((item->pollUs != 0) && ((next == 0) || (item->nextPollNs < next))) {
+            next = item->nextPollNs;
+        }
+    }
+
+    if (next == 0) {
+        return -1;
+    }
+    /*epoll counts in ms, round up rather than spin*/
+    return (next <= now) ? 0 : (int) ((next - now + 999999ULL) / 1000000ULL);
+}
+
+static void IscReactorRun(void *data)
+{
+    IscReactorLoop *loop = (IscReactorLoop *) data;
+    struct epoll_event evs[ISC_REACTOR_EVENTS];
+
+    prctl(PR_SET_NAME, "ISCREACTOR");
+    reactorSelf = 1;
+    ISCLOGI("Func: %s", __func__);
+
+    while (!__atomic_load_n(&(loop->stopping), __ATOMIC_ACQUIRE)) {
+        int timeout = IscReactorPoll(loop);
+        int n = epoll_wait(loop->epollFd, evs, ISC_REACTOR_EVENTS, timeout);
+        int i;
+
+        for (i = 0; i < n; i++) {
+            uint64_t tag = evs[i].data.u64;
+            uint64_t count;
+            IscReactorItem *item;
+
+            if (tag == ISC_REACTOR_CTRL) {
+                (void) read(loop->ctrlFd, &count, sizeof(count));
+                continue;
+            }
+
+            item = &(loop->items[tag >> 1]);
+            if (__atomic_load_n(&(item->task), __ATOMIC_ACQUIRE) == NULL) {
+                continue;
+            }
+            if (tag & 1) {
+                /*backend posted data*/
+                (void) read(item->readyFd, &count, sizeof(count));
+                IscReactorRead(item);
+            }
+            else {
+                IscReactorService(loop, item, (uint32) (tag >> 1));
+            }
+        }
+    }
+}
+
+static IscResult IscReactorStart(IscReactorLoop *loop)
+{
+    struct epoll_event ev;
+    uint32 i;
+
+    loop->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epollFd < 0) {
+        ISCLOGE("%s epoll create error", __func__);
+        return ISC_RESULT_FAILURE;
+    }
+    loop->ctrlFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->ctrlFd < 0) {
+        ISCLOGE("%s control fd create error", __func__);
+        close(loop->epollFd);
+        return ISC_RESULT_FAILURE;
+    }
+    ev.events = EPOLLIN;
+    ev.data.u64 = ISC_REACTOR_CTRL;
+    (void) epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, loop->ctrlFd, &ev);
+    /*never destroyed: a deinit may still be waking up from one after stop*/
+    for (i = 0; (i < ISC_REACTOR_ITEMS) && !loop->eventsReady; i++) {
+        (void) IscEventCreate(&(loop->items[i].gone));
+    }
+    loop->eventsReady = 1;
+    loop->stopping = 0;
+
+    if (IscThreadCreateEx(IscReactorRun, loop, ISC_DEFAULT_STACK_SIZE, 0, 0,
+                          "IscReactor", &(loop->thread)) != ISC_RESULT_SUCCESS) {
+        close(loop->ctrlFd);
+        close(loop->epollFd);
+        return ISC_RESULT_NO_MORE_THREADS;
+    }
+    loop->started = 1;
+    return ISC_RESULT_SUCCESS;
+}
+
+#endif /* ISC_HAVE_EVENTFD */
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscSetThreadMode
+ *
+ *  DESCRIPTION
+ *      Select per-id task threads or the reactor.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_FAILURE          otherwise
+ *----------------------------------------------------------------------------*/
+IscResult IscSetThreadMode(uint8 mode, uint8 loops)
+{
+    IscResult result = ISC_RESULT_SUCCESS;
+    uint8 id;
+    uint8 i;
+
+    if (mode > ISC_THREAD_MODE_REACTOR) {
+        return ISC_RESULT_FAILURE;
+    }
+#ifndef ISC_HAVE_EVENTFD
+    (void) loops;
+    if (mode == ISC_THREAD_MODE_REACTOR) {
+        return ISC_RESULT_FAILURE;
+    }
+#endif
+
+    IscGlobalMutexLock();
+    for (id = 0; id < ISC_MAX_CHANNELS; id++) {
+        for (i = 0; i < ISC_MAX_TASK; i++) {
+            if (mThreadEntry[id][i] != NULL) {
+                result = ISC_RESULT_FAILURE;
+            }
+        }
+    }
+    if (result == ISC_RESULT_SUCCESS) {
+        reactorMode = mode;
+#ifdef ISC_HAVE_EVENTFD
+        if (loops == 0) {
+            loops = 1;
+        }
+        reactorLoops = (loops > ISC_REACTOR_MAX_LOOPS) ? ISC_REACTOR_MAX_LOOPS : loops;
+#endif
+    }
+    IscGlobalMutexUnlock();
+    return result;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscGetThreadMode
+ *
+ *  RETURNS
+ *      ISC_THREAD_MODE_TASK or ISC_THREAD_MODE_REACTOR
+ *----------------------------------------------------------------------------*/
+uint8 IscGetThreadMode(void)
+{
+    return reactorMode;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscReactorDel
+ *
+ *  DESCRIPTION
+ *      Set ISC_EXIT_EVENT on the task and wait until its loop dropped it.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_POINTER  in case the task is invalid
+ *          ISC_RESULT_FAILURE          in case called on a loop thread
+ *----------------------------------------------------------------------------*/
+IscResult IscReactorDel(IscThreadEntry *task, uint8 taskType)
+{
+#ifdef ISC_HAVE_EVENTFD
+    IscReactorItem *item;
+    uint32 eventBits;
+
+    if ((task == NULL) || (taskType >= ISC_MAX_TASK)) {
+        return ISC_RESULT_INVALID_POINTER;
+    }
+    if (reactorSelf) {
+        return ISC_RESULT_FAILURE;
+    }
+
+    item = &(reactorLoop[task->id % reactorLoops].items[task->id * ISC_MAX_TASK + taskType]);
+    IscTaskWake(task, ISC_EXIT_EVENT);
+    while (__atomic_load_n(&(item->task), __ATOMIC_ACQUIRE) == task) {
+        (void) IscEventWait(&(item->gone), ISC_EVENT_WAIT_INFINITE, &eventBits);
+    }
+    return ISC_RESULT_SUCCESS;
+#else
+    (void) task;
+    (void) taskType;
+    return ISC_RESULT_FAILURE;
+#endif
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscReactorIsLoopThread
+ *
+ *  RETURNS
+ *      1 when called on a reactor loop thread
+ *----------------------------------------------------------------------------*/
+uint8 IscReactorIsLoopThread(void)
+{
+#ifdef ISC_HAVE_EVENTFD
+    return reactorSelf;
+#else
+    return 0;
+#endif
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscReactorAdd
+ *
+ *  DESCRIPTION
+ *      Hand a read or write task to its event loop.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_POINTER  in case the task is invalid
+ *          ISC_RESULT_NO_MORE_THREADS  in case the loop cannot be started
+ *          ISC_RESULT_FAILURE          otherwise
+ *----------------------------------------------------------------------------*/
+IscResult IscReactorAdd(IscThreadEntry *task, uint8 taskType)
+{
+#ifdef ISC_HAVE_EVENTFD
+    IscReactorLoop *loop;
+    IscReactorItem *item;
+    IscResult result = ISC_RESULT_SUCCESS;
+    struct epoll_event ev;
+    uint32 index;
+    uint64_t one = 1;
+
+    if ((task == NULL) || (taskType >= ISC_MAX_TASK)) {
+        return ISC_RESULT_INVALID_POINTER;
+    }
+    if (task->wakeFd < 0) {
+        return ISC_RESULT_FAILURE;
+    }
+
+    /*held until the task is on the loop, IscReactorStop sees it or not at all*/
+    loop = &(reactorLoop[task->id % reactorLoops]);
+    IscGlobalMutexLock();
+    if (!loop->started) {
+        result = IscReactorStart(loop);
+    }
+    if (result != ISC_RESULT_SUCCESS) {
+        IscGlobalMutexUnlock();
+        return result;
+    }
+
+    index = task->id * ISC_MAX_TASK + taskType;
+    item = &(loop->items[index]);
+    item->taskType = taskType;
+    item->channel = ChannelMatrix[task->id][taskType].ch;
+    item->readyFd = -1;
+    item->pollUs = 0;
+    item->again = 0;
+    item->exiting = 0;
+    item->nextPollNs = 0;
+    item->starting = (taskType == ISC_WR_TASK);
+    if ((taskType == ISC_RD_TASK) &&
+        (ChannelConfig[task->id][taskType].readyMode != ISC_READY_NOTIFY)) {
+        /*FD mode polls too until the backend registers its fd*/
+        item->pollUs = ChannelConfig[task->id][taskType].pollIntervalUs;
+    }
+    task->running = 1;
+    __atomic_store_n(&(item->task), task, __ATOMIC_RELEASE);
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = ISC_REACTOR_TAG(index, 0);
+    if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, task->wakeFd, &ev) != 0) {
+        __atomic_store_n(&(item->task), NULL, __ATOMIC_RELEASE);
+        task->running = 0;
+        IscGlobalMutexUnlock();
+        return ISC_RESULT_FAILURE;
+    }
+    /*let the loop recompute its poll timeout*/
+    (void) write(loop->ctrlFd, &one, sizeof(one));
+    IscGlobalMutexUnlock();
+    ISCLOGI("%s: id %d task %d on loop %d", __func__, task->id, taskType, task->id % reactorLoops);
+    return ISC_RESULT_SUCCESS;
+#else
+    (void) task;
+    (void) taskType;
+    return ISC_RESULT_FAILURE;
+#endif
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscReactorStop
+ *
+ *  DESCRIPTION
+ *      Stop the event loop threads once no task is left on any of them:
+ *      wake each loop through its control fd, join it and close its fds.
+ *      The next IscReactorAdd starts them again.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success, or no loop running
+ *          ISC_RESULT_FAILURE          in case tasks remain or called on a
+ *                                      loop thread
+ *----------------------------------------------------------------------------*/
+IscResult IscReactorStop(void)
+{
+#ifdef ISC_HAVE_EVENTFD
+    uint64_t one = 1;
+    uint32 i;
+    uint8 n;
+
+    if (reactorSelf) {
+        return ISC_RESULT_FAILURE;
+    }
+
+    /*IscReactorAdd holds it until its task is published: none can slip in.
+      Empty loops run no callbacks, so joining under it cannot deadlock*/
+    IscGlobalMutexLock();
+    for (n = 0; n < ISC_REACTOR_MAX_LOOPS; n++) {
+        for (i = 0; reactorLoop[n].started && (i < ISC_REACTOR_ITEMS); i++) {
+            if (__atomic_load_n(&(reactorLoop[n].items[i].task), __ATOMIC_ACQUIRE) != NULL) {
+                IscGlobalMutexUnlock();
+                return ISC_RESULT_FAILURE;
+            }
+        }
+    }
+    for (n = 0; n < ISC_REACTOR_MAX_LOOPS; n++) {
+        IscReactorLoop *loop = &(reactorLoop[n]);
+
+        if (!loop->started) {
+            continue;
+        }
+        __atomic_store_n(&(loop->stopping), 1, __ATOMIC_RELEASE);
+        (void) write(loop->ctrlFd, &one, sizeof(one));
+        (void) IscThreadJoin(&(loop->thread));
+        close(loop->ctrlFd);
+        close(loop->epollFd);
+        loop->started = 0;
+        ISCLOGI("%s: loop %d stopped", __func__, n);
+    }
+    IscGlobalMutexUnlock();
+    return ISC_RESULT_SUCCESS;
+#else
+    return ISC_RESULT_SUCCESS;
+#endif
+}
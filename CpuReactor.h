@@ -0,0 +1,123 @@
+#ifndef __CPU_REACTOR_H__
+#define __CPU_REACTOR_H__
+
+#include "types.h"
+#include "CpuExt.h"
+#include "CpuThread.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/* Thread modes, chosen before the first IscThreadInit */
+#define ISC_THREAD_MODE_TASK        0   /*one read and one write thread per id*/
+#define ISC_THREAD_MODE_REACTOR     1   /*all ids share epoll event loop thread(s)*/
+
+#define ISC_REACTOR_MAX_LOOPS       4
+#define ISC_REACTOR_READ_BUDGET     64  /*messages read per channel and wakeup*/
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscSetThreadMode
+ *
+ *  DESCRIPTION
+ *      Select per-id task threads or the reactor. In reactor mode ids are
+ *      spread over loops event loop threads (id % loops). Channels that are
+ *      read without waiting (above ISC_MAX_NORMAL_CHANNEL) keep their own
+ *      read thread. Must be called before IscThreadInit.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_FAILURE          in case the mode is unknown, no
+ *                                      epoll support, or tasks exist already
+ *
+ *----------------------------------------------------------------------------*/
+
+IscResult IscSetThreadMode(uint8 mode, uint8 loops);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscGetThreadMode
+ *
+ *  RETURNS
+ *      ISC_THREAD_MODE_TASK or ISC_THREAD_MODE_REACTOR
+ *
+ *----------------------------------------------------------------------------*/
+
+uint8 IscGetThreadMode(void);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscReactorAdd
+ *
+ *  DESCRIPTION
+ *      Hand a read or write task to its event loop, starting the loop thread
+ *      on first use. The task needs a wake fd. It leaves the loop when its
+ *      ISC_EXIT_EVENT is set.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_POINTER  in case the task is invalid
+ *          ISC_RESULT_NO_MORE_THREADS  in case the loop cannot be started
+ *          ISC_RESULT_FAILURE          otherwise
+ *
+ *----------------------------------------------------------------------------*/
+
+IscResult IscReactorAdd(IscThreadEntry *task, uint8 taskType);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscReactorDel
+ *
+ *  DESCRIPTION
+ *      Set ISC_EXIT_EVENT on a task added with IscReactorAdd and wait until
+ *      its loop flushed or discarded it and will not touch it again.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_POINTER  in case the task is invalid
+ *          ISC_RESULT_FAILURE          in case called on a loop thread
+ *
+ *----------------------------------------------------------------------------*/
+
+IscResult IscReactorDel(IscThreadEntry *task, uint8 taskType);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscReactorStop
+ *
+ *  DESCRIPTION
+ *      Stop and join the event loop threads and close their epoll and
+ *      control fds, once every task left them. IscThreadDeinit calls it
+ *      when it removed the last reactor task. The next IscReactorAdd
+ *      starts the loops again.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success, or no loop running
+ *          ISC_RESULT_FAILURE          in case tasks remain or called on a
+ *                                      loop thread
+ *
+ *----------------------------------------------------------------------------*/
+
+IscResult IscReactorStop(void);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscReactorIsLoopThread
+ *
+ *  RETURNS
+ *      1 when called on a reactor loop thread, for example from a receive
+ *      callback in reactor mode
+ *
+ *----------------------------------------------------------------------------*/
+
+uint8 IscReactorIsLoopThread(void);
+
+#ifdef  __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,197 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "CpuExt.h"
+#include "private.h"
+#include "CpuRing.h"
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscRingCreate
+ *
+ *  DESCRIPTION
+ *      Allocate the slots of a ring. Slot i starts with sequence i, which
+ *      marks it free for the producer holding position i.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_POINTER  in case the ring pointer is invalid
+ *          ISC_RESULT_FAILURE          in case the slots cannot be allocated
+ *----------------------------------------------------------------------------*/
+IscResult IscRingCreate(IscMsgRing *ring, uint32 capacity)
+{
+    uint32 size = 2;
+    uint32 i;
+
+    if (ring == NULL) {
+        return ISC_RESULT_INVALID_POINTER;
+    }
+
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    memset(ring, 0, sizeof(IscMsgRing));
+    ring->cells = (IscRingCell *) IscMalloc(size * sizeof(IscRingCell));
+    if (ring->cells == NULL) {
+        return ISC_RESULT_FAILURE;
+    }
+
+    for (i = 0; i < size; i++) {
+        ring->cells[i].sequence = i;
+        ring->cells[i].message = NULL;
+        ring->cells[i].length = 0;
+        ring->cells[i].stampNs = 0;
+    }
+    ring->mask = size - 1;
+    return ISC_RESULT_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscRingDestroy
+ *
+ *  DESCRIPTION
+ *      Free the slots of a ring.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscRingDestroy(IscMsgRing *ring)
+{
+    if ((ring == NULL) || (ring->cells == NULL)) {
+        return;
+    }
+
+    IscFree(ring->cells);
+    ring->cells = NULL;
+    ring->mask = 0;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscRingPush
+ *
+ *  DESCRIPTION
+ *      Claim the slot at enqueuePos with a CAS, fill it, then publish it to
+ *      the consumer by advancing its sequence.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_FAILURE          in case the ring is full
+ *----------------------------------------------------------------------------*/
+IscResult IscRingPush(IscMsgRing *ring, uint8 *message, uint16 length, uint64_t stampNs)
+{
+    IscRingCell *cell;
+    uint32 pos;
+
+    if ((ring == NULL) || (ring->cells == NULL)) {
+        return ISC_RESULT_FAILURE;
+    }
+
+    pos = __atomic_load_n(&(ring->enqueuePos), __ATOMIC_RELAXED);
+    for (;;) {
+        int32 dif;
+
+        cell = &(ring->cells[pos & ring->mask]);
+        dif = (int32) (__atomic_load_n(&(cell->sequence), __ATOMIC_ACQUIRE) - pos);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&(ring->enqueuePos), &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        }
+        else if (dif < 0) {
+            /* the consumer has not freed this slot yet */
+            return ISC_RESULT_FAILURE;
+        }
+        else {
+            pos = __atomic_load_n(&(ring->enqueuePos), __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->message = message;
+    cell->length = length;
+    cell->stampNs = stampNs;
+    __atomic_store_n(&(cell->sequence), pos + 1, __ATOMIC_RELEASE);
+    return ISC_RESULT_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscRingPop
+ *
+ *  DESCRIPTION
+ *      Claim the slot at dequeuePos with a CAS once its producer has
+ *      published it, then hand it back to producers one lap ahead.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_FAILURE          in case the ring is empty
+ *----------------------------------------------------------------------------*/
+IscResult IscRingPop(IscMsgRing *ring, uint8 **message, uint16 *length, uint64_t *stampNs)
+{
+    IscRingCell *cell;
+    uint32 pos;
+
+    if ((ring == NULL) || (ring->cells == NULL)) {
+        return ISC_RESULT_FAILURE;
+    }
+
+    pos = __atomic_load_n(&(ring->dequeuePos), __ATOMIC_RELAXED);
+    for (;;) {
+        int32 dif;
+
+        cell = &(ring->cells[pos & ring->mask]);
+        dif = (int32) (__atomic_load_n(&(cell->sequence), __ATOMIC_ACQUIRE) - (pos + 1));
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&(ring->dequeuePos), &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        }
+        else if (dif < 0) {
+            /* no producer has published this slot yet */
+            return ISC_RESULT_FAILURE;
+        }
+        else {
+            pos = __atomic_load_n(&(ring->dequeuePos), __ATOMIC_RELAXED);
+        }
+    }
+
+    if (message) {
+        *message = cell->message;
+    }
+    if (length) {
+        *length = cell->length;
+    }
+    if (stampNs) {
+        *stampNs = cell->stampNs;
+    }
+    cell->message = NULL;
+    __atomic_store_n(&(cell->sequence), pos + ring->mask + 1, __ATOMIC_RELEASE);
+    return ISC_RESULT_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscRingCount
+ *
+ *  DESCRIPTION
+ *      Number of queued messages.
+ *
+ *  RETURNS
+ *      uint32
+ *----------------------------------------------------------------------------*/
+uint32 IscRingCount(IscMsgRing *ring)
+{
+    if ((ring == NULL) || (ring->cells == NULL)) {
+        return 0;
+    }
+
+    return __atomic_load_n(&(ring->enqueuePos), __ATOMIC_RELAXED) -
+           __atomic_load_n(&(ring->dequeuePos), __ATOMIC_RELAXED);
+}
@@ -0,0 +1,129 @@
+#ifndef __CPU_RING_H__
+#define __CPU_RING_H__
+
+#include "types.h"
+#include "CpuExt.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#define ISC_CACHE_LINE_SIZE 64
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  one slot of the message ring, sequence tells producers and the
+ *         consumer whether the slot is free or holds a message
+ */
+/* ----------------------------------------------------------------------------*/
+typedef struct
+{
+    uint32 sequence;
+    uint16 length;
+    uint8* message;
+    uint64_t stampNs;        /*enqueue time given by the producer*/
+}IscRingCell;
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  bounded multi-producer/multi-consumer message ring, the write
+ *         task is the regular consumer, senders dropping the oldest message
+ *         pop as well. Both positions live on separate cache lines
+ */
+/* ----------------------------------------------------------------------------*/
+typedef struct
+{
+    IscRingCell* cells;
+    uint32 mask;
+    uint8 pad0[ISC_CACHE_LINE_SIZE - sizeof(IscRingCell*) - sizeof(uint32)];
+    uint32 enqueuePos;       /*shared by all producers*/
+    uint8 pad1[ISC_CACHE_LINE_SIZE - sizeof(uint32)];
+    uint32 dequeuePos;       /*shared by all consumers*/
+    uint8 pad2[ISC_CACHE_LINE_SIZE - sizeof(uint32)];
+}IscMsgRing;
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscRingCreate
+ *
+ *  DESCRIPTION
+ *      Allocate the slots of a ring. capacity is rounded up to the next
+ *      power of two.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_POINTER  in case the ring pointer is invalid
+ *          ISC_RESULT_FAILURE          in case the slots cannot be allocated
+ *
+ *----------------------------------------------------------------------------*/
+
+IscResult IscRingCreate(IscMsgRing *ring, uint32 capacity);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscRingDestroy
+ *
+ *  DESCRIPTION
+ *      Free the slots of a ring. Messages still queued are not freed.
+ *
+ *  RETURNS
+ *      void
+ *
+ *----------------------------------------------------------------------------*/
+
+void IscRingDestroy(IscMsgRing *ring);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscRingPush
+ *
+ *  DESCRIPTION
+ *      Append a message with its enqueue time, may be called from any
+ *      thread. A single CAS on enqueuePos unless another producer races
+ *      for the same slot.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_FAILURE          in case the ring is full
+ *
+ *----------------------------------------------------------------------------*/
+
+IscResult IscRingPush(IscMsgRing *ring, uint8 *message, uint16 length, uint64_t stampNs);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscRingPop
+ *
+ *  DESCRIPTION
+ *      Remove the oldest message, safe from any thread. Any of the out
+ *      pointers may be NULL.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_FAILURE          in case the ring is empty
+ *
+ *----------------------------------------------------------------------------*/
+
+IscResult IscRingPop(IscMsgRing *ring, uint8 **message, uint16 *length, uint64_t *stampNs);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscRingCount
+ *
+ *  DESCRIPTION
+ *      Number of queued messages, only a snapshot when producers are active.
+ *
+ *  RETURNS
+ *      uint32
+ *
+ *----------------------------------------------------------------------------*/
+
+uint32 IscRingCount(IscMsgRing *ring);
+
+#ifdef  __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,496 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "CpuExt.h"
+#include "private.h"
+#include "CpuRing.h"
+#include "CpuStats.h"
+#include "CpuChannel.h"
+#include "CpuDispatch.h"
+
+/* Counters are kept per recording task and summed by IscGetStats. Each
+ * block has one writing thread and a cache line of its own, so recording
+ * is a relaxed load and store with no other core touching the line. */
+#define ISC_STATS_ADD(field, n) \
+    __atomic_store_n(&(field), __atomic_load_n(&(field), __ATOMIC_RELAXED) + (n), __ATOMIC_RELAXED)
+
+/* the write task of an id */
+typedef struct
+{
+    uint64_t txMsgs;
+    uint64_t txBytes;
+    uint32 writes;
+    uint32 retries;
+    uint32 wakeups;
+    uint32 idleWakeups;
+    uint32 writeErrors[ISC_STATS_ERR_CODES];
+    IscHistogram writeLatency;
+}__attribute__((aligned(ISC_CACHE_LINE_SIZE))) IscStatsWriter;
+
+/* the read task of an id */
+typedef struct
+{
+    uint64_t rxMsgs;
+    uint64_t rxBytes;
+    uint32 dispatchStalls;
+    IscHistogram readLatency;
+}__attribute__((aligned(ISC_CACHE_LINE_SIZE))) IscStatsReader;
+
+/* one dispatch worker, for every id it runs callbacks of */
+typedef struct
+{
+    IscHistogram dispatchLatency;
+}__attribute__((aligned(ISC_CACHE_LINE_SIZE))) IscStatsWorker;
+
+/* raised by any sender with a CAS, written only when a new maximum is seen */
+typedef struct
+{
+    uint32 queueHighWater;
+    uint32 queueBytesHighWater;
+}__attribute__((aligned(ISC_CACHE_LINE_SIZE))) IscStatsQueue;
+
+static IscStatsWriter statsWriter[ISC_MAX_CHANNELS];
+static IscStatsReader statsReader[ISC_MAX_CHANNELS];
+static IscStatsWorker statsWorker[ISC_DISPATCH_MAX_WORKERS][ISC_MAX_CHANNELS];
+static IscStatsQueue statsQueue[ISC_MAX_CHANNELS];
+
+static void IscStatsMax32(uint32 *target, uint32 value)
+{
+    uint32 cur = __atomic_load_n(target, __ATOMIC_RELAXED);
+
+    while ((value > cur) &&
+           !__atomic_compare_exchange_n(target, &cur, value, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static uint32 IscHistBucket(uint64_t ns)
+{
+    uint32 msb;
+
+    if (ns < ISC_HIST_SUB_COUNT) {
+        return (uint32) ns;
+    }
+    msb = 63 - (uint32) __builtin_clzll(ns);
+    if (msb > ISC_HIST_MAX_BIT) {
+        return ISC_HIST_BUCKETS - 1;
+    }
+    return (msb - ISC_HIST_SUB_BITS + 1) * ISC_HIST_SUB_COUNT +
+           (uint32) ((ns >> (msb - ISC_HIST_SUB_BITS)) & (ISC_HIST_SUB_COUNT - 1));
+}
+
+static uint64_t IscHistBucketTop(uint32 index)
+{
+    uint32 shift;
+    uint64_t low;
+
+    if (index < ISC_HIST_SUB_COUNT) {
+        return index;
+    }
+    shift = index / ISC_HIST_SUB_COUNT - 1;
+    low = (uint64_t) (ISC_HIST_SUB_COUNT + index % ISC_HIST_SUB_COUNT) << shift;
+    return low + ((uint64_t) 1 << shift) - 1;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscHistRecord
+ *
+ *  DESCRIPTION
+ *      Add one sample to a histogram.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscHistRecord(IscHistogram *hist, uint64_t ns)
+{
+    uint64_t max = __atomic_load_n(&(hist->maxNs), __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&(hist->bucket[IscHistBucket(ns)]), 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(hist->sumNs), ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(hist->count), 1, __ATOMIC_RELAXED);
+    while ((ns > max) &&
+           !__atomic_compare_exchange_n(&(hist->maxNs), &max, ns, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/* IscHistRecord for a histogram only the calling thread writes */
+static void IscHistAdd(IscHistogram *hist, uint64_t ns)
+{
+    ISC_STATS_ADD(hist->bucket[IscHistBucket(ns)], 1);
+    ISC_STATS_ADD(hist->sumNs, ns);
+    ISC_STATS_ADD(hist->count, 1);
+    if (ns > __atomic_load_n(&(hist->maxNs), __ATOMIC_RELAXED)) {
+        __atomic_store_n(&(hist->maxNs), ns, __ATOMIC_RELAXED);
+    }
+}
+
+/* add src into dst, src read field by field while it may still change */
+static void IscHistMerge(IscHistogram *dst, const IscHistogram *src)
+{
+    uint64_t maxNs = __atomic_load_n(&(src->maxNs), __ATOMIC_RELAXED);
+    uint32 i;
+
+    dst->count += __atomic_load_n(&(src->count), __ATOMIC_RELAXED);
+    dst->sumNs += __atomic_load_n(&(src->sumNs), __ATOMIC_RELAXED);
+    if (maxNs > dst->maxNs) {
+        dst->maxNs = maxNs;
+    }
+    for (i = 0; i < ISC_HIST_BUCKETS; i++) {
+        dst->bucket[i] += __atomic_load_n(&(src->bucket[i]), __ATOMIC_RELAXED);
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscStatsTx
+ *
+ *  DESCRIPTION
+ *      A write of msgs messages and bytes bytes succeeded, latencyNs after
+ *      its oldest message was queued.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscStatsTx(uint8 id, uint16 msgs, uint32 bytes, uint64_t latencyNs)
+{
+    IscStatsWriter *st;
+
+    if (id >= ISC_MAX_CHANNELS) {
+        return;
+    }
+    st = &(statsWriter[id]);
+    ISC_STATS_ADD(st->txMsgs, msgs);
+    ISC_STATS_ADD(st->txBytes, bytes);
+    ISC_STATS_ADD(st->writes, 1);
+    IscHistAdd(&(st->writeLatency), latencyNs);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscStatsRx
+ *
+ *  DESCRIPTION
+ *      A read of bytes bytes went to the callback as msgs messages, which
+ *      was called latencyNs after the read.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscStatsRx(uint8 id, uint16 msgs, uint32 bytes, uint64_t latencyNs)
+{
+    IscStatsReader *st;
+
+    if (id >= ISC_MAX_CHANNELS) {
+        return;
+    }
+    st = &(statsReader[id]);
+    ISC_STATS_ADD(st->rxMsgs, msgs);
+    ISC_STATS_ADD(st->rxBytes, bytes);
+    IscHistAdd(&(st->readLatency), latencyNs);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscStatsWriteError
+ *
+ *  DESCRIPTION
+ *      Count a failed IscWrite by its error code.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscStatsWriteError(uint8 id, int16 errID)
+{
+    uint32 index = 0;
+
+    if (id >= ISC_MAX_CHANNELS) {
+        return;
+    }
+    if ((errID < 0) && (errID > -ISC_STATS_ERR_CODES)) {
+        index = (uint32) -errID;
+    }
+    ISC_STATS_ADD(statsWriter[id].writeErrors[index], 1);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscStatsRetry
+ *
+ *  DESCRIPTION
+ *      Count a repeated IscWrite attempt.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscStatsRetry(uint8 id)
+{
+    if (id >= ISC_MAX_CHANNELS) {
+        return;
+    }
+    ISC_STATS_ADD(statsWriter[id].retries, 1);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscStatsWakeup
+ *
+ *  DESCRIPTION
+ *      Count a wakeup of the write task, worked 0 if it found nothing to do.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscStatsWakeup(uint8 id, uint8 worked)
+{
+    if (id >= ISC_MAX_CHANNELS) {
+        return;
+    }
+    ISC_STATS_ADD(statsWriter[id].wakeups, 1);
+    if (!worked) {
+        ISC_STATS_ADD(statsWriter[id].idleWakeups, 1);
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscStatsDispatch
+ *
+ *  DESCRIPTION
+ *      A dispatch worker starts a callback latencyNs after the read task
+ *      handed the message over.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscStatsDispatch(uint8 id, uint8 worker, uint64_t latencyNs)
+{
+    if ((id >= ISC_MAX_CHANNELS) || (worker >= ISC_DISPATCH_MAX_WORKERS)) {
+        return;
+    }
+    IscHistAdd(&(statsWorker[worker][id].dispatchLatency), latencyNs);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscStatsDispatchStall
+ *
+ *  DESCRIPTION
+ *      Count a read task held back by the dispatch workers.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscStatsDispatchStall(uint8 id)
+{
+    if (id >= ISC_MAX_CHANNELS) {
+        return;
+    }
+    ISC_STATS_ADD(statsReader[id].dispatchStalls, 1);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscStatsQueueDepth
+ *
+ *  DESCRIPTION
+ *      Raise the queue high-water marks, called by senders after queueing.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscStatsQueueDepth(uint8 id, uint32 msgs, uint32 bytes)
+{
+    if (id >= ISC_MAX_CHANNELS) {
+        return;
+    }
+    IscStatsMax32(&(statsQueue[id].queueHighWater), msgs);
+    IscStatsMax32(&(statsQueue[id].queueBytesHighWater), bytes);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscGetStats
+ *
+ *  DESCRIPTION
+ *      Sum the blocks of the write task, the read task and every dispatch
+ *      worker of channel id.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_HANDLE   in case the id is invalid
+ *          ISC_RESULT_INVALID_POINTER  in case the stats pointer is invalid
+ *----------------------------------------------------------------------------*/
+IscResult IscGetStats(uint8 id, IscStats *stats)
+{
+    IscStatsWriter *wr;
+    IscStatsReader *rd;
+    uint32 i;
+
+    if (id >= ISC_MAX_CHANNELS) {
+        return ISC_RESULT_INVALID_HANDLE;
+    }
+    if (stats == NULL) {
+        return ISC_RESULT_INVALID_POINTER;
+    }
+
+    memset(stats, 0, sizeof(IscStats));
+    wr = &(statsWriter[id]);
+    stats->txMsgs = __atomic_load_n(&(wr->txMsgs), __ATOMIC_RELAXED);
+    stats->txBytes = __atomic_load_n(&(wr->txBytes), __ATOMIC_RELAXED);
+    stats->writes = __atomic_load_n(&(wr->writes), __ATOMIC_RELAXED);
+    stats->retries = __atomic_load_n(&(wr->retries), __ATOMIC_RELAXED);
+    stats->wakeups = __atomic_load_n(&(wr->wakeups), __ATOMIC_RELAXED);
+    stats->idleWakeups = __atomic_load_n(&(wr->idleWakeups), __ATOMIC_RELAXED);
+    for (i = 0; i < ISC_STATS_ERR_CODES; i++) {
+        stats->writeErrors[i] = __atomic_load_n(&(wr->writeErrors[i]), __ATOMIC_RELAXED);
+    }
+    IscHistMerge(&(stats->writeLatency), &(wr->writeLatency));
+
+    rd = &(statsReader[id]);
+    stats->rxMsgs = __atomic_load_n(&(rd->rxMsgs), __ATOMIC_RELAXED);
+    stats->rxBytes = __atomic_load_n(&(rd->rxBytes), __ATOMIC_RELAXED);
+    stats->dispatchStalls = __atomic_load_n(&(rd->dispatchStalls), __ATOMIC_RELAXED);
+    IscHistMerge(&(stats->readLatency), &(rd->readLatency));
+
+    for (i = 0; i < ISC_DISPATCH_MAX_WORKERS; i++) {
+        IscHistMerge(&(stats->dispatchLatency), &(statsWorker[i][id].dispatchLatency));
+    }
+
+    stats->queueHighWater = __atomic_load_n(&(statsQueue[id].queueHighWater), __ATOMIC_RELAXED);
+    stats->queueBytesHighWater = __atomic_load_n(&(statsQueue[id].queueBytesHighWater), __ATOMIC_RELAXED);
+    return ISC_RESULT_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscHistPercentile
+ *
+ *  DESCRIPTION
+ *      Upper bound of the bucket holding the given percentile.
+ *
+ *  RETURNS
+ *      latency in ns, 0 for an empty histogram
+ *----------------------------------------------------------------------------*/
+uint64_t IscHistPercentile(const IscHistogram *hist, uint32 permille)
+{
+    uint64_t total = 0;
+    uint64_t target;
+    uint64_t seen = 0;
+    uint32 i;
+
+    if (hist == NULL) {
+        return 0;
+    }
+    for (i = 0; i < ISC_HIST_BUCKETS; i++) {
+        total += hist->bucket[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    if (permille > 1000) {
+        permille = 1000;
+    }
+
+    target = (total * permille + 999) / 1000;
+    if (target == 0) {
+        target = 1;
+    }
+    for (i = 0; i < ISC_HIST_BUCKETS; i++) {
+        seen += hist->bucket[i];
+        if (seen >= target) {
+            break;
+        }
+    }
+    if (i >= ISC_HIST_BUCKETS - 1) {
+        return hist->maxNs;
+    }
+    return (IscHistBucketTop(i) < hist->maxNs) ? IscHistBucketTop(i) : hist->maxNs;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscStatsReset
+ *
+ *  DESCRIPTION
+ *      Zero every block of id. Its write and read tasks are gone, a
+ *      dispatch worker still finishing a callback of id may count once
+ *      more.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscStatsReset(uint8 id)
+{
+    uint32 i;
+
+    if (id >= ISC_MAX_CHANNELS) {
+        return;
+    }
+    memset(&(statsWriter[id]), 0, sizeof(statsWriter[id]));
+    memset(&(statsReader[id]), 0, sizeof(statsReader[id]));
+    for (i = 0; i < ISC_DISPATCH_MAX_WORKERS; i++) {
+        memset(&(statsWorker[i][id]), 0, sizeof(statsWorker[i][id]));
+    }
+    memset(&(statsQueue[id]), 0, sizeof(statsQueue[id]));
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscStatsDump
+ *
+ *  DESCRIPTION
+ *      Log the counters and p50/p99/max latencies of channel id.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscStatsDump(uint8 id)
+{
+    IscStats *stats;
+    uint32 errors = 0;
+    uint32 i;
+
+    stats = (IscStats *) IscMalloc(sizeof(IscStats));
+    if (stats == NULL) {
+        return;
+    }
+    if (IscGetStats(id, stats) != ISC_RESULT_SUCCESS) {
+        IscFree(stats);
+        return;
+    }
+
+    for (i = 0; i < ISC_STATS_ERR_CODES; i++) {
+        errors += stats->writeErrors[i];
+    }
+    ISCLOGI("stats id %d tx %llu msgs %llu bytes in %u writes, rx %llu msgs %llu bytes",
+            id, (unsigned long long) stats->txMsgs, (unsigned long long) stats->txBytes,
+            stats->writes, (unsigned long long) stats->rxMsgs,
+            (unsigned long long) stats->rxBytes);
+    ISCLOGI("stats id %d write errors %u retries %u queue high %u msgs %u bytes",
+            id, errors, stats->retries, stats->queueHighWater, stats->queueBytesHighWater);
+    ISCLOGI("stats id %d writer wakeups %u, %u found no work",
+            id, stats->wakeups, stats->idleWakeups);
+    for (i = 0; i < ISC_STATS_ERR_CODES; i++) {
+        if (stats->writeErrors[i] != 0) {
+            ISCLOGI("stats id %d errID %d: %u", id, -(int) i, stats->writeErrors[i]);
+        }
+    }
+    ISCLOGI("stats id %d write latency us p50 %llu p99 %llu max %llu",
+            id, (unsigned long long) (IscHistPercentile(&(stats->writeLatency), 500) / 1000),
+            (unsigned long long) (IscHistPercentile(&(stats->writeLatency), 990) / 1000),
+            (unsigned long long) (stats->writeLatency.maxNs / 1000));
+    ISCLOGI("stats id %d read latency us p50 %llu p99 %llu max %llu",
+            id, (unsigned long long) (IscHistPercentile(&(stats->readLatency), 500) / 1000),
+            (unsigned long long) (IscHistPercentile(&(stats->readLatency), 990) / 1000),
+            (unsigned long long) (stats->readLatency.maxNs / 1000));
+    if (stats->dispatchLatency.count != 0) {
+        ISCLOGI("stats id %d dispatch latency us p50 %llu p99 %llu max %llu, %u stalls",
+                id, (unsigned long long) (IscHistPercentile(&(stats->dispatchLatency), 500) / 1000),
+                (unsigned long long) (IscHistPercentile(&(stats->dispatchLatency), 990) / 1000),
+                (unsigned long long) (stats->dispatchLatency.maxNs / 1000), stats->dispatchStalls);
+    }
+    IscFree(stats);
+}
@@ -0,0 +1,158 @@
+#ifndef __CPU_STATS_H__
+#define __CPU_STATS_H__
+
+#include "types.h"
+#include "CpuExt.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/* Log-linear latency histogram in ns: values below 8 have a bucket each,
+ * above that every power of two is split into 8 buckets (<= 12.5% error).
+ * The last bucket also holds everything above 2^36 ns (~69 s). */
+#define ISC_HIST_SUB_BITS       3
+#define ISC_HIST_SUB_COUNT      (1 << ISC_HIST_SUB_BITS)
+#define ISC_HIST_MAX_BIT        36
+#define ISC_HIST_BUCKETS        ((ISC_HIST_MAX_BIT - ISC_HIST_SUB_BITS + 2) * ISC_HIST_SUB_COUNT)
+
+/* IscWrite error codes counted one by one, -1 .. -(ISC_STATS_ERR_CODES - 1),
+ * anything else goes to writeErrors[0] */
+#define ISC_STATS_ERR_CODES     128
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  latency histogram, bucket counts plus exact count/sum/max
+ */
+/* ----------------------------------------------------------------------------*/
+typedef struct
+{
+    uint32 count;
+    uint64_t sumNs;
+    uint64_t maxNs;
+    uint32 bucket[ISC_HIST_BUCKETS];
+}IscHistogram;
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  counters of one channel id, see IscGetStats
+ */
+/* ----------------------------------------------------------------------------*/
+typedef struct
+{
+    uint64_t txMsgs;         /*messages IscWrite accepted*/
+    uint64_t txBytes;        /*bytes IscWrite accepted, batch framing included*/
+    uint64_t rxMsgs;         /*messages handed to the receive callback*/
+    uint64_t rxBytes;        /*bytes IscRead/IscSRead returned*/
+    uint32 writes;           /*IscWrite calls that succeeded*/
+    uint32 retries;          /*IscWrite attempts repeated after ISC_ERR_NOMEM*/
+    uint32 queueHighWater;   /*max messages in the write queue, all lanes*/
+    uint32 queueBytesHighWater;
+    uint32 wakeups;          /*write task woken by a sender, the backend or a flush*/
+    uint32 idleWakeups;      /*of those, wakeups that found nothing to write*/
+    uint32 dispatchStalls;   /*times the reader was held back by
+                               ISC_DISPATCH_QUEUE_MAX queued messages*/
+    uint32 writeErrors[ISC_STATS_ERR_CODES];  /*indexed by -errID*/
+    IscHistogram writeLatency;    /*enqueue until IscWrite returned success*/
+    IscHistogram readLatency;     /*IscRead returned until the callback was
+                                    called or handed to the dispatch workers*/
+    IscHistogram dispatchLatency; /*handed to the dispatch workers until the
+                                    callback started*/
+}IscStats;
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscGetStats
+ *
+ *  DESCRIPTION
+ *      Snapshot the counters and histograms of channel id, summed over the
+ *      tasks recording them. Every field is read atomically, the snapshot
+ *      as a whole is not.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_INVALID_HANDLE   in case the id is invalid
+ *          ISC_RESULT_INVALID_POINTER  in case the stats pointer is invalid
+ *
+ *----------------------------------------------------------------------------*/
+
+IscResult IscGetStats(uint8 id, IscStats *stats);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscHistRecord
+ *
+ *  DESCRIPTION
+ *      Add one sample to a histogram, for callers keeping their own
+ *      latency figures. Safe against concurrent callers.
+ *
+ *  RETURNS
+ *      void
+ *
+ *----------------------------------------------------------------------------*/
+
+void IscHistRecord(IscHistogram *hist, uint64_t ns);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscHistPercentile
+ *
+ *  DESCRIPTION
+ *      Upper bound of the bucket holding the given percentile, permille
+ *      from 0 to 1000 (990 for p99).
+ *
+ *  RETURNS
+ *      latency in ns, 0 for an empty histogram
+ *
+ *----------------------------------------------------------------------------*/
+
+uint64_t IscHistPercentile(const IscHistogram *hist, uint32 permille);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscStatsDump
+ *
+ *  DESCRIPTION
+ *      Log the counters and p50/p99/max latencies of channel id.
+ *
+ *  RETURNS
+ *      void
+ *
+ *----------------------------------------------------------------------------*/
+
+void IscStatsDump(uint8 id);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscStatsReset
+ *
+ *  DESCRIPTION
+ *      Zero the counters of channel id, for IscChannelRemove once its tasks
+ *      are gone.
+ *
+ *  RETURNS
+ *      void
+ *
+ *----------------------------------------------------------------------------*/
+
+void IscStatsReset(uint8 id);
+
+/* Recording side. Tx, WriteError, Retry and Wakeup are called by the write
+ * task of id only, Rx and DispatchStall by its read task, Dispatch by
+ * dispatch worker number worker: each of them counts into a block of its
+ * own with plain relaxed stores. QueueDepth is called by any sender and
+ * raises the high-water marks with a CAS. */
+void IscStatsTx(uint8 id, uint16 msgs, uint32 bytes, uint64_t latencyNs);
+void IscStatsRx(uint8 id, uint16 msgs, uint32 bytes, uint64_t latencyNs);
+void IscStatsWriteError(uint8 id, int16 errID);
+void IscStatsRetry(uint8 id);
+void IscStatsWakeup(uint8 id, uint8 worked);
+void IscStatsDispatch(uint8 id, uint8 worker, uint64_t latencyNs);
+void IscStatsDispatchStall(uint8 id);
+void IscStatsQueueDepth(uint8 id, uint32 msgs, uint32 bytes);
+
+#ifdef  __cplusplus
+}
+#endif
+#endif
@@ -4,9 +4,20 @@
 #include "private.h"
 #include "CpuIf.h"
 #include "CpuThread.h"
+#include "CpuChannel.h"
+#include "CpuPool.h"
+#include "CpuTrace.h"
+#include "CpuStats.h"
+#include "CpuDispatch.h"
+#include "CpuMix.h"
 #include "types.h"
 #include "CpuExt.h"
 
+#ifdef ISC_HAVE_EVENTFD
+#include <poll.h>
+#include <unistd.h>
+#endif
+
 #ifdef CPU_FOR_LINUX
 #include <utils/Log.h>
 #else
@@ -17,110 +28,542 @@
 extern "C" {
 #endif
 
-static int8 iscWriteRes[ISC_MAX_ID] ={ISC_SUCCESS};
-static uint8 reSendCount[ISC_MAX_ID] ={0};
+static int8 iscWriteRes[ISC_MAX_CHANNELS] ={ISC_SUCCESS};
+
+/* head of line retry while the peer has no room (ISC_ERR_NOMEM):
+ * backoff doubles from MIN to MAX with jitter, the message is dropped
+ * after RETRY_MAX attempts */
+#define ISC_WRITE_BACKOFF_MIN_US 100
+#define ISC_WRITE_BACKOFF_MAX_US 10000
+#define ISC_WRITE_RETRY_MAX      16
+
+#ifdef ISC_NO_MSG_TRACE
+#define ISC_MSG_TRACE_ON() 0
+#else
+static uint8 iscMsgTrace = (ISC_MSG_TRACE_DEFAULT != 0);
+#define ISC_MSG_TRACE_ON() __atomic_load_n(&iscMsgTrace, __ATOMIC_RELAXED)
+#endif
 /* include read thread & write thread*/
- IscThreadEntry* mThreadEntry[ISC_MAX_ID][ISC_MAX_TASK] = {{NULL, NULL},};
- IscReceivedMsg mReceiveCb[ISC_MAX_ID];
- const ISC_CHANNALE_MATRIX_T ChannelMatrix[ISC_MAX_ID][ISC_MAX_TASK] =
-{
-    {{FUNC_WR_CHANNEL, "FuncWr"}, {FUNC_RD_CHANNEL, "FuncRd"}},
-    {{SYSD_WR_CHANNEL,"SysdWr"}, {SYSD_RD_CHANNEL, "SysdRd"}},
-    {{TESTMODE_WR_CHANNEL, "TstWr"}, {TESTMODE_RD_CHANNEL, "TstRd"}},
-    {{LOG_WR_CHANNEL, "LogWr"}, {LOG_RD_CHANNEL, "LogRd"}},
-    {{INVALID_CHANNEL,"InvaildWr"},{INVALID_CHANNEL,"InvaildRd"}},
-    {{INVALID_CHANNEL,"InvaildWr"},{INVALID_CHANNEL,"InvaildRd"}},
-    {{HID_WR_CHANNEL,"HidWr"},{HID_RD_CHANNEL,"HidRd"}},
-    {{MIX_WR_CHANNEL,"MixWr"},{MIX_RD_CHANNEL,"MixRd"}},
-    {{INVALID_CHANNEL,"InvaildWr"},{ITRONECNS_RD_CHANNEL,"EcnsRd"}},
-};
-
-static void IscPutMessage(uint8 id, uint8* msg, uint16 len);
-static uint8 IscGetOneMessage(IscThreadEntry * task, uint8 **msg, uint16* len);
+ IscThreadEntry* mThreadEntry[ISC_MAX_CHANNELS][ISC_MAX_TASK] = {{NULL, NULL},};
+ IscReceivedMsg mReceiveCb[ISC_MAX_CHANNELS];
+static IscReceivedBuf mReceiveBufCb[ISC_MAX_CHANNELS];
+static IscReadUnblock readUnblock = NULL;
+
+typedef struct
+{
+    IscReceivedMsgBatch cb;
+    uint16 maxMsgs;          /*1..ISC_RECV_BATCH_MAX*/
+    uint32 maxBytes;         /*payload bytes per call, 0: no limit*/
+}IscRecvBatchCfg;
+static IscRecvBatchCfg mReceiveBatch[ISC_MAX_CHANNELS];
+
+/*messages collected for one batch callback and the reads they point into*/
+typedef struct
+{
+    ISC_READ_MSG_T msgs[ISC_RECV_BATCH_MAX];
+    uint8* bufs[ISC_RECV_BATCH_MAX];
+    uint16 count;
+    uint16 bufCount;
+    uint32 bytes;
+    uint64_t firstNs;        /*read time of the oldest message*/
+}IscRecvBatch;
+
+static ISC_QUEUE_STATS_T queueStats[ISC_MAX_CHANNELS];
+
+/* callers inside IscTaskAcquire/IscTaskRelease, deinit frees the tasks
+ * of an id only once this is back to 0 */
+static uint32 iscTaskUsers[ISC_MAX_CHANNELS];
+/* deinit calls waiting for iscTaskUsers to drop to 0, and the event the
+ * last user sets for them. Created on first use, never destroyed, so a
+ * late set cannot touch freed memory */
+static uint32 iscTaskWaiters[ISC_MAX_CHANNELS];
+static IscEventHandle iscUnusedEvent[ISC_MAX_CHANNELS];
+static uint8 iscUnusedReady[ISC_MAX_CHANNELS];
+
+/* lanes by falling priority, and the position of each lane in it */
+static const uint8 laneOrder[ISC_PRIO_LANES] = {ISC_PRIO_HIGH, ISC_PRIO_NORMAL, ISC_PRIO_BULK};
+static const uint8 laneRank[ISC_PRIO_LANES] = {1, 0, 2};
+
+typedef struct
+{
+    uint32 highWater;
+    uint32 sent;
+    uint64_t waitNs;         /*sum of enqueue to take time*/
+    uint32 waitMaxUs;
+}IscLaneCounters;
+
+static IscLaneCounters laneStats[ISC_MAX_CHANNELS][ISC_PRIO_LANES];
+
+static int8 IscPutMessage(uint8 id, uint8* msg, uint16 len, const ISC_SEND_OPTIONS_T* opt);
+static uint8 IscGetOneMessage(IscThreadEntry * task, uint8 **msg, uint16* len, uint64_t* stampNs);
+static uint8 IscLanePop(IscThreadEntry* task, uint8 lane, uint8 **msg, uint16* len, uint64_t* stampNs);
+static uint32 IscWriterUnpark(IscThreadEntry* task, uint32 eventBits);
 
 IscThreadEntry* IscGetTaskEntry(uint8 id, uint8 task)
 {
-    if(id >=ISC_MAX_ID|| task >= ISC_MAX_TASK)
+    if(id >=ISC_MAX_CHANNELS|| task >= ISC_MAX_TASK)
         return NULL;
 
    return  mThreadEntry[id][task];
 }
 
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  task of id pinned until IscTaskRelease, NULL once deinit started
+ */
+/* ----------------------------------------------------------------------------*/
+IscThreadEntry* IscTaskAcquire(uint8 id, uint8 task)
+{
+    IscThreadEntry* entry;
+
+    if(id >= ISC_MAX_CHANNELS || task >= ISC_MAX_TASK)
+        return NULL;
+
+    (void) __atomic_fetch_add(&(iscTaskUsers[id]), 1, __ATOMIC_SEQ_CST);
+    entry = __atomic_load_n(&(mThreadEntry[id][task]), __ATOMIC_SEQ_CST);
+    if(entry == NULL || __atomic_load_n(&(entry->closing), __ATOMIC_SEQ_CST))
+    {
+        IscTaskRelease(id);
+        return NULL;
+    }
+    return entry;
+}
+
+void IscTaskRelease(uint8 id)
+{
+    /*deinit waiting: it wakes the next blocked sender or finds 0*/
+    (void) __atomic_fetch_sub(&(iscTaskUsers[id]), 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&(iscTaskWaiters[id]), __ATOMIC_SEQ_CST) != 0)
+    {
+        IscEventSet(&(iscUnusedEvent[id]), ISC_UNUSED_EVENT);
+    }
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  wait until nobody uses the tasks of id any more, called by deinit
+ *         after unpublishing them. Senders blocked on a full queue of
+ *         writer are woken until they all gave up.
+ */
+/* ----------------------------------------------------------------------------*/
+void IscTaskWaitUnused(uint8 id, IscThreadEntry* writer)
+{
+    uint32 eventBits;
+
+    IscGlobalMutexLock();
+    if(!iscUnusedReady[id])
+    {
+        (void) IscEventCreate(&(iscUnusedEvent[id]));
+        iscUnusedReady[id] = 1;
+    }
+    IscGlobalMutexUnlock();
+
+    /*announce first: a release after this sets the event*/
+    (void) __atomic_fetch_add(&(iscTaskWaiters[id]), 1, __ATOMIC_SEQ_CST);
+    while(__atomic_load_n(&(iscTaskUsers[id]), __ATOMIC_SEQ_CST) != 0)
+    {
+        /*one blocked sender per wake, each one leaving sets the event again*/
+        if(writer != NULL && __atomic_load_n(&(writer->spaceWaiters), __ATOMIC_SEQ_CST) != 0)
+        {
+            IscEventSet(&(writer->spaceHandle), ISC_SPACE_EVENT);
+        }
+        (void) IscEventWait(&(iscUnusedEvent[id]), ISC_EVENT_WAIT_INFINITE, &eventBits);
+    }
+    /*a second deinit of id may have lost the event to this one*/
+    if(__atomic_sub_fetch(&(iscTaskWaiters[id]), 1, __ATOMIC_SEQ_CST) != 0)
+    {
+        IscEventSet(&(iscUnusedEvent[id]), ISC_UNUSED_EVENT);
+    }
+}
+
 IscThreadEntry* IscAllocTaskEntry(uint8 id, uint8 task)
 {
-    if(id >=ISC_MAX_ID|| task >= ISC_MAX_TASK)
+    if(id >=ISC_MAX_CHANNELS|| task >= ISC_MAX_TASK)
     {
         return NULL;
     }
 	mThreadEntry[id][task] =  (IscThreadEntry*)IscMalloc(sizeof(IscThreadEntry));
 	if(mThreadEntry[id][task] != NULL)
 	{
-		mThreadEntry[id][task]->instanceData = NULL;
-		mThreadEntry[id][task]->mQueueFirst = NULL;
-		mThreadEntry[id][task]->mQueueLast = NULL;
+		memset(mThreadEntry[id][task], 0, sizeof(IscThreadEntry));
+		mThreadEntry[id][task]->readyFd = -1;
+		mThreadEntry[id][task]->wakeFd = -1;
 	}
     return mThreadEntry[id][task];
 }
 
-static void API_BUFFER_DUMP(char* tmp, uint16 maxLen, void* msg, uint16 len)
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  run the receive callback of id, on ISC_MIX_ID the one of the
+ *         message's mix_id first
+ */
+/* ----------------------------------------------------------------------------*/
+static void IscDeliverMsg(uint8 id, uint8* buf, uint16 len)
+{
+    if(id == ISC_MIX_ID)
+    {
+        IscMixDeliver(buf, len, mReceiveCb[id]);
+    }
+    else if(mReceiveCb[id] != NULL)
+    {
+        (mReceiveCb[id])(buf, len);
+    }
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  split a framed batch from the peer and deliver every message
+ *
+ * @retval messages delivered
+ */
+/* ----------------------------------------------------------------------------*/
+static uint16 IscDeliverFramed(uint8 id, uint8* buf, uint16 len)
+{
+    uint32 pos = 0;
+    uint16 frames = 0;
+
+    while(pos + ISC_BATCH_HDR_SIZE <= len)
+    {
+        uint16 frameLen = (uint16)(buf[pos] | (buf[pos + 1] << 8));
+        pos += ISC_BATCH_HDR_SIZE;
+        if(pos + frameLen > len)
+        {
+            ISCLOGE("%s id %d bad frame length %d at %d", __func__, id, frameLen, pos);
+            return frames;
+        }
+        IscDeliverMsg(id, &buf[pos], frameLen);
+        pos += frameLen;
+        frames++;
+    }
+    return frames;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  run the buffer callback of id, else the plain one, on buf
+ */
+/* ----------------------------------------------------------------------------*/
+void IscReceiveDeliver(uint8 id, IscBuffer* buf)
 {
-    uint16 i = 0;
+    IscReceivedBuf bufCb = __atomic_load_n(&(mReceiveBufCb[id]), __ATOMIC_ACQUIRE);
+
+    if(bufCb != NULL)
+    {
+        bufCb(buf);
+    }
+    else
+    {
+        IscDeliverMsg(id, buf->data, buf->length);
+    }
+}
 
-    if(len > 20)
-        len = 20;
-    snprintf(tmp+strlen(tmp), maxLen-strlen(tmp), "[");
-    if((msg == NULL) || (len == 0))
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  hand one handle to the dispatch workers, or run the callback on it
+ *         here, and drop the reader's reference
+ */
+/* ----------------------------------------------------------------------------*/
+static void IscDeliverHandle(uint8 id, IscReceivedBuf cb, IscBuffer* msg, uint8 dispatch)
+{
+    if(dispatch)
+    {
+        IscDispatchSubmit(msg);
+        return;
+    }
+    if(cb != NULL)
     {
-        snprintf(tmp+strlen(tmp), maxLen-strlen(tmp), " ");
+        cb(msg);
     }
     else
     {
-        for(; i < len; i++)
+        IscReceiveDeliver(id, msg);
+    }
+    IscBufferRelease(msg);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  loan a read to the buffer callback or the dispatch workers, one
+ *         handle per framed message pointing into it. buf belongs to the
+ *         handles afterwards
+ *
+ * @retval messages delivered
+ */
+/* ----------------------------------------------------------------------------*/
+static uint16 IscDeliverLoaned(uint8 id, IscReceivedBuf cb, uint8* buf, uint16 len, uint8 dispatch)
+{
+    IscBuffer* read;
+    IscBuffer* msg;
+    uint32 pos = 0;
+    uint16 frames = 0;
+
+    read = IscBufferWrap(id, buf, buf, len, NULL);
+    if(read == NULL)
+    {
+        IscFree(buf);
+        return 0;
+    }
+    if(ChannelConfig[id][ISC_RD_TASK].batchBytes == 0)
+    {
+        IscDeliverHandle(id, cb, read, dispatch);
+        return 1;
+    }
+    while(pos + ISC_BATCH_HDR_SIZE <= len)
+    {
+        uint16 frameLen = (uint16)(buf[pos] | (buf[pos + 1] << 8));
+        pos += ISC_BATCH_HDR_SIZE;
+        if(pos + frameLen > len)
+        {
+            ISCLOGE("%s id %d bad frame length %d at %d", __func__, id, frameLen, pos);
+            break;
+        }
+        msg = IscBufferWrap(id, NULL, &buf[pos], frameLen, read);
+        if(msg == NULL)
         {
-            snprintf(tmp+strlen(tmp), maxLen-strlen(tmp), "0x%.2X,",*((unsigned char*)msg + i));
+            break;
         }
+        IscDeliverHandle(id, cb, msg, dispatch);
+        pos += frameLen;
+        frames++;
     }
-    snprintf(tmp+strlen(tmp), maxLen-strlen(tmp), "]");
+    IscBufferRelease(read);
+    return frames;
 }
 
-void IscAsyncReadTaskLoop(void* data)
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  hand the collected messages to the batch callback, then free the
+ *         reads behind them
+ *
+ * @param keepLast  the newest read still has frames to deliver, keep it
+ */
+/* ----------------------------------------------------------------------------*/
+static void IscRecvBatchDeliver(uint8 id, IscReceivedMsgBatch cb, IscRecvBatch* batch, uint8 keepLast)
 {
+    uint16 i;
+    uint16 freeCount = batch->bufCount - ((keepLast && batch->bufCount != 0) ? 1 : 0);
 
-    IscThreadEntry* task = (IscThreadEntry*)data;
-    uint8 result = ISC_SUCCESS;
+    if(batch->count != 0)
+    {
+        uint64_t latencyNs = IscTimeNowNs() - batch->firstNs;
+        cb(batch->msgs, batch->count);
+        IscStatsRx(id, batch->count, batch->bytes, latencyNs);
+    }
+    for(i = 0; i < freeCount; i++)
+    {
+        IscFree(batch->bufs[i]);
+    }
+    if(freeCount != batch->bufCount)
+    {
+        batch->bufs[0] = batch->bufs[batch->bufCount - 1];
+    }
+    batch->bufCount -= freeCount;
+    batch->count = 0;
+    batch->bytes = 0;
+    batch->firstNs = IscTimeNowNs();
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  IscReadDrain for a batch callback: collect up to maxMsgs messages
+ *         or maxBytes payload bytes, framed reads split in place, and
+ *         deliver them in one call
+ *
+ * @retval 1 if the budget ran out before the channel was empty
+ */
+/* ----------------------------------------------------------------------------*/
+static uint8 IscReadDrainBatched(IscThreadEntry* task, uint32 channel, uint16 budget, \
+                                 IscReceivedMsgBatch cb)
+{
     uint8 id = task->id;
-    uint32 eventBits;
-    task->running = 1;
-    uint32 channel = ChannelMatrix[id][ISC_RD_TASK].ch;
+    IscRecvBatch batch;
+    uint16 maxMsgs = mReceiveBatch[id].maxMsgs;
+    uint32 maxBytes = mReceiveBatch[id].maxBytes;
+    uint8 framed = (ChannelConfig[id][ISC_RD_TASK].batchBytes != 0);
+    uint16 reads = 0;
+    uint8 more = 0;
+    int err;
+    uint8* buf;
 
-    if(channel == INVALID_CHANNEL)
+    if(maxMsgs == 0 || maxMsgs > ISC_RECV_BATCH_MAX)
     {
-        ISCLOGI("Func: %s,ch:%x if invalid!", __func__,channel);
-        return;
+        maxMsgs = ISC_RECV_BATCH_MAX;
     }
-    IscSetTaskName(id,ISC_RD_TASK);
-    ISCLOGI("Func: %s", __func__);
-
-    if(task != NULL)
+    batch.count = 0;
+    batch.bufCount = 0;
+    batch.bytes = 0;
+    batch.firstNs = 0;
+    for(;;)
     {
-        while(task->running)
+        if(budget != 0 && reads++ >= budget)
+        {
+            more = 1;
+            break;
+        }
+        buf = NULL;
+        if(id == ISC_FUNC_ID)
+        {
+            err = IscRead(channel, &buf);
+        }else
+        {
+            err = IscSRead(channel, &buf);
+        }
+        if(err <= 0 || buf == NULL)
         {
-            int err = 0;
-            uint8* buf = NULL;
-		int hasdata = 1;
-            eventBits = 0;
-            /*wait for exit event && delay 10ms for read from shared memory*/
-            if(channel<=ISC_MAX_NORMAL_CHANNEL)
+            if(buf)
             {
-                result = IscEventWait(&(task->handle), 3, &eventBits);
+                IscFree(buf);
             }
-            if((result == ISC_SUCCESS) && (eventBits & ISC_EXIT_EVENT))
+            break;
+        }
+        if(ISC_MSG_TRACE_ON())
+        {
+            IscTraceMessage(id, ISC_TRACE_READ, buf, err);
+        }
+        if(batch.count == 0)
+        {
+            batch.firstNs = IscTimeNowNs();
+        }
+        batch.bufs[batch.bufCount++] = buf;
+        if(framed)
+        {
+            uint32 pos = 0;
+            while(pos + ISC_BATCH_HDR_SIZE <= (uint32)err)
             {
-                task->running = 0;
-                break;
+                uint16 frameLen = (uint16)(buf[pos] | (buf[pos + 1] << 8));
+                pos += ISC_BATCH_HDR_SIZE;
+                if(pos + frameLen > (uint32)err)
+                {
+                    ISCLOGE("%s id %d bad frame length %d at %d", __func__, id, frameLen, pos);
+                    break;
+                }
+                if(batch.count == maxMsgs)
+                {
+                    IscRecvBatchDeliver(id, cb, &batch, 1);
+                }
+                batch.msgs[batch.count].message = &buf[pos];
+                batch.msgs[batch.count].length = frameLen;
+                batch.count++;
+                batch.bytes += frameLen;
+                pos += frameLen;
             }
+        }
+        else
+        {
+            batch.msgs[batch.count].message = buf;
+            batch.msgs[batch.count].length = (uint16)err;
+            batch.count++;
+            batch.bytes += (uint32)err;
+        }
+        /*every read holds at least one message unless it was all bad frames,
+          so bufs cannot fill before msgs does*/
+        if(batch.count >= maxMsgs || batch.bufCount == ISC_RECV_BATCH_MAX || \
+           (maxBytes != 0 && batch.bytes >= maxBytes))
+        {
+            IscRecvBatchDeliver(id, cb, &batch, 0);
+        }
+    }
+    IscRecvBatchDeliver(id, cb, &batch, 0);
+    return more;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  sleep until the peer may have posted data or an event is set
+ *
+ * @param task
+ * @param channel
+ * @param eventBits  events received, ISC_EXIT_EVENT among them
+ *
+ * @retval
+ */
+/* ----------------------------------------------------------------------------*/
+static IscResult IscReadWait(IscThreadEntry* task, uint32 channel, uint32* eventBits)
+{
+    const ISC_CHANNEL_CONFIG_T* cfg = &(ChannelConfig[task->id][ISC_RD_TASK]);
+
+#ifdef ISC_HAVE_EVENTFD
+    int readyFd = __atomic_load_n(&(task->readyFd), __ATOMIC_ACQUIRE);
+    if(cfg->readyMode == ISC_READY_FD && readyFd >= 0)
+    {
+        struct pollfd fds[2];
+        uint64_t count;
+
+        fds[0].fd = readyFd;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        fds[1].fd = task->wakeFd;
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+        /*without a wake fd the exit event is only seen by polling*/
+        (void) poll(fds, 2, (task->wakeFd >= 0) ? -1 : (int)((cfg->pollIntervalUs + 999) / 1000));
+        /*reset the counters before draining so no post is lost*/
+        if(fds[0].revents & POLLIN)
+        {
+            (void) read(readyFd, &count, sizeof(count));
+        }
+        if(fds[1].revents & POLLIN)
+        {
+            /*consume, then re-arm: a wake in between writes again*/
+            (void) read(task->wakeFd, &count, sizeof(count));
+            __atomic_store_n(&(task->wakePending), 0, __ATOMIC_SEQ_CST);
+        }
+        return IscEventWait(&(task->handle), 0, eventBits);
+    }
+#endif
+    if(cfg->readyMode == ISC_READY_NOTIFY)
+    {
+        return IscEventWait(&(task->handle), ISC_EVENT_WAIT_INFINITE, eventBits);
+    }
+    /*wait for exit event && delay for read from shared memory*/
+    if(channel<=ISC_MAX_NORMAL_CHANNEL)
+    {
+        return IscEventWaitUntil(&(task->handle), 0xFFFFFFFF, ISC_EVENT_WAIT_ANY, \
+                                 IscTimeNowNs() + (uint64_t)cfg->pollIntervalUs * 1000, eventBits);
+    }
+    /*the read itself blocks in the driver, only look for the exit event,
+      or sleep while the dispatch workers hold the reader back*/
+    return IscEventWait(&(task->handle), IscDispatchHeld(task->id) ? ISC_EVENT_WAIT_INFINITE : 0, \
+                        eventBits);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  read and deliver messages until the channel is empty
+ *
+ * @param task
+ * @param channel
+ * @param budget  max messages to read, 0 for no limit
+ *
+ * @retval 1 if the budget ran out before the channel was empty
+ */
+/* ----------------------------------------------------------------------------*/
+uint8 IscReadDrain(IscThreadEntry* task, uint32 channel, uint16 budget)
+{
+    uint8 id = task->id;
+    uint16 count = 0;
+    int err = 0;
+    uint8* buf = NULL;
+	int hasdata = 1;
+    IscReceivedMsgBatch batchCb = __atomic_load_n(&(mReceiveBatch[id].cb), __ATOMIC_ACQUIRE);
+    IscReceivedBuf bufCb = __atomic_load_n(&(mReceiveBufCb[id]), __ATOMIC_ACQUIRE);
+    uint8 dispatch;
+
+    if(batchCb != NULL)
+    {
+        return IscReadDrainBatched(task, channel, budget, batchCb);
+    }
 		while(hasdata)
 		{
+	            if(budget != 0 && count++ >= budget)
+	            {
+	                return 1;
+	            }
+	            /*the workers are behind, a worker wakes the task when they caught up*/
+	            if(IscDispatchHold(id))
+	            {
+	                return 0;
+	            }
 	            /*read msg*/
 	            if(id == ISC_FUNC_ID)
 	            {
@@ -132,13 +575,42 @@ void IscAsyncReadTaskLoop(void* data)
 
 	            if(err > 0 && buf != NULL)
 	            {
-	                if(mReceiveCb[id] != NULL)
+	                uint64_t readNs = IscTimeNowNs();
+	                uint64_t latencyNs;
+	                uint16 frames = 1;
+	                dispatch = IscDispatchEnter(id);
+	                if(bufCb != NULL || dispatch)
+	                {
+	                    if(ISC_MSG_TRACE_ON())
+	                    {
+	                        IscTraceMessage(id, ISC_TRACE_READ, buf, err);
+	                    }
+	                    latencyNs = IscTimeNowNs() - readNs;
+	                    /*loaned, the last IscBufferRelease frees it*/
+	                    frames = IscDeliverLoaned(id, bufCb, buf, err, dispatch);
+	                    buf = NULL;
+	                    if(dispatch)
+	                    {
+	                        IscDispatchLeave();
+	                    }
+	                    IscStatsRx(id, frames, err, latencyNs);
+	                }
+	                else if(mReceiveCb[id] != NULL || id == ISC_MIX_ID)
 	                {
-	                    char tmp[1024];
-	                    memset(tmp, 0, sizeof(tmp));
-	                    API_BUFFER_DUMP(tmp, 1024, buf, err);
-	                    ISCLOGT("Callback: %s length %d id %d,%s ", __func__, err, id,tmp);
-	                    (mReceiveCb[id])(buf, err);
+	                    if(ISC_MSG_TRACE_ON())
+	                    {
+	                        IscTraceMessage(id, ISC_TRACE_READ, buf, err);
+	                    }
+	                    latencyNs = IscTimeNowNs() - readNs;
+	                    if(ChannelConfig[id][ISC_RD_TASK].batchBytes != 0)
+	                    {
+	                        frames = IscDeliverFramed(id, buf, err);
+	                    }
+	                    else
+	                    {
+	                        IscDeliverMsg(id, buf, err);
+	                    }
+	                    IscStatsRx(id, frames, err, latencyNs);
 	                }
 			}
 			else
@@ -148,186 +620,925 @@ void IscAsyncReadTaskLoop(void* data)
 	            if(buf)
 	            {
 	                IscFree(buf);
+	                buf = NULL;
 	            }
 		}
-        }
-    }
-ISCLOGT("%s,@@@@@@@@@@@@@@EXIT FUNCION,id:%d",__func__,id);
+    return 0;
 }
 
-
-void IscAsyncWriteTaskLoop(void* data)
+void IscAsyncReadTaskLoop(void* data)
 {
+
     IscThreadEntry* task = (IscThreadEntry*)data;
-    IscResult result;
+    uint8 result = ISC_SUCCESS;
     uint8 id = task->id;
-    uint32 eventBits = 0;
+    uint32 eventBits;
+    task->running = 1;
+    uint32 channel = ChannelMatrix[id][ISC_RD_TASK].ch;
+    /*blocking reads: one message per round so the exit event is seen*/
+    uint16 budget = (channel > ISC_MAX_NORMAL_CHANNEL) ? 1 : 0;
 
-    uint32 channel = ChannelMatrix[id][ISC_WR_TASK].ch;
     if(channel == INVALID_CHANNEL)
     {
         ISCLOGI("Func: %s,ch:%x if invalid!", __func__,channel);
-        return;
+        task->running = 0;
     }
-    IscSetTaskName(id,ISC_WR_TASK);
-    ISCLOGI("Func: %s", __func__);
-    task->running = 1;
-    /*set thread name todo */
-    if(task != NULL)
+    else
     {
-        while(task->running)
+        IscSetTaskName(id,ISC_RD_TASK);
+        ISCLOGI("Func: %s", __func__);
+    }
+
+    while(task->running)
+    {
+        eventBits = 0;
+        result = IscReadWait(task, channel, &eventBits);
+        if((result == ISC_SUCCESS) && (eventBits & ISC_EXIT_EVENT))
         {
-            eventBits = 0;
-            result = IscEventWait(&(task->handle), ISC_EVENT_WAIT_INFINITE, &eventBits);
-            if(result == ISC_RESULT_SUCCESS && eventBits != 0)
-            {
-		uint8* message = NULL;
-		uint16 len;
-                /*exit event*/
-                if(eventBits & ISC_EXIT_EVENT)
-                {
-                    task->running = 0;
-                    /*exit task*/
-			while(IscGetOneMessage(task, &message, &len) == 0x00)
-			{
-				if(message != NULL)
-				{
-	                            IscFree(message);
-					message = NULL;
-				}
-			}
-                    break;
-                }
-                /*have msg*/
-                if(eventBits | ISC_MSG_EVENT)
-                {
-                    /*received send msg*/
-                    ISCLOGT("**********************%s id %d  task  %p ********************", __func__, id, task);
-                    while(IscGetOneMessage(task, &message, &len) == 0x00)
-                    {
-                        char tmp[1024];
-                        memset(tmp, 0, sizeof(tmp));
-                        API_BUFFER_DUMP(tmp, 1024, message, len);
-                        ISCLOGT("%s,*********Write*****,%d,%s",__func__, id,tmp);
-                        iscWriteRes[id] = IscWrite(channel, message, len);
-                        if(iscWriteRes[id]  < ISC_SUCCESS)
-                        {
-                            ISCLOGE("ISC write error, the errID:%d",iscWriteRes[id]);
-                            if(iscWriteRes[id] == ISC_ERR_NOMEM)
-                            {
-                                if(reSendCount[id] > 4)
-                                {
-                                    ISCLOGE("****the buffer is full, cannot write data again");
-                                }
-                                else{
-                                    reSendCount[id]++;
-                                    IscThreadSleep(10);
-                                    IscPutMessage(id,message,len);
-					continue;
-                                }
-                            }
-                            else
-                            {
-                                ISCLOGE("ISC write error, the errID:%d",iscWriteRes[id]);
-                            }
-                        }
-                        else
-                        {
-                            reSendCount[id] =0;
-                        }
-                        if(message != NULL)
-                        {
-                            IscFree(message);
-				message = NULL;
-                        }
-                    }
-                }
-            }
+            task->running = 0;
+            break;
         }
+        (void) IscReadDrain(task, channel, budget);
     }
-
 ISCLOGT("%s,@@@@@@@@@@@@@@EXIT FUNCION,id:%d",__func__,id);
-
+    /*deinit joins after this, the entry outlives the set*/
+    IscEventSet(&(task->doneHandle), ISC_DONE_EVENT);
 }
 
-static uint8 IscGetOneMessage(IscThreadEntry * task, uint8 **msg, uint16* len)
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  delay before the next attempt of the held write, doubling per
+ *         attempt, jittered over its upper half so writers of several ids
+ *         do not retry in lockstep
+ */
+/* ----------------------------------------------------------------------------*/
+static uint64_t IscWriteBackoffNs(IscThreadEntry* task)
 {
-    uint8 flag = 0XFF;
-    if(task != NULL)
+    uint32 us = ISC_WRITE_BACKOFF_MAX_US;
+    uint32 x = task->retrySeed;
+
+    if(task->retryCount <= 8)
     {
-        IscMsgQueueEntry* message = NULL;
-        IscMutexLock(&(task->mMutex));
-        if(task->mQueueFirst != NULL)
-        {
-            message = task->mQueueFirst;
-            if(message)
+        us = ISC_WRITE_BACKOFF_MIN_US << (task->retryCount - 1);
+        if(us > ISC_WRITE_BACKOFF_MAX_US)
+            us = ISC_WRITE_BACKOFF_MAX_US;
+    }
+
+    if(x == 0)
+    {
+        x = (uint32)(uintptr_t)task ^ (uint32)IscTimeNowNs();
+        x |= 1;
+    }
+    /*xorshift32*/
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    task->retrySeed = x;
+
+    us = us / 2 + x % (us / 2 + 1);
+    return (uint64_t)us * 1000;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  hand buf to the backend. If the peer has no room buf is kept as
+ *         the head of line write and retried after a backoff, nothing
+ *         queued behind it is written first.
+ *
+ * @param frames   messages in buf, for the drop counter
+ * @param stampNs  enqueue time of the oldest message in buf
+ *
+ * @retval 1 if buf is done with (written or dropped), 0 if it is held
+ */
+/* ----------------------------------------------------------------------------*/
+static uint8 IscWriteSend(IscThreadEntry* task, uint32 channel, uint8* buf, uint16 len, \
+                          uint16 frames, uint64_t stampNs)
+{
+    uint8 id = task->id;
+
+    iscWriteRes[id] = IscWrite(channel, buf, len);
+    if(iscWriteRes[id] < ISC_SUCCESS)
+    {
+        IscStatsWriteError(id, iscWriteRes[id]);
+    }
+    else
+    {
+        IscStatsTx(id, frames, len, IscTimeNowNs() - stampNs);
+    }
+    if(iscWriteRes[id] == ISC_ERR_NOMEM && task->retryCount < ISC_WRITE_RETRY_MAX)
+    {
+        task->retryMsg = buf;
+        task->retryLen = len;
+        task->retryFrames = frames;
+        task->retryStampNs = stampNs;
+        task->retryCount++;
+        task->retryAtNs = IscTimeNowNs() + IscWriteBackoffNs(task);
+        __atomic_store_n(&(task->txWanted), 1, __ATOMIC_SEQ_CST);
+        return 0;
+    }
+
+    if(iscWriteRes[id] < ISC_SUCCESS)
+    {
+        ISCLOGE("ISC write error, the errID:%d after %d retries",iscWriteRes[id], task->retryCount);
+        __atomic_fetch_add(&(queueStats[id].discarded), frames, __ATOMIC_RELAXED);
+    }
+    task->retryMsg = NULL;
+    task->retryCount = 0;
+    __atomic_store_n(&(task->txWanted), 0, __ATOMIC_SEQ_CST);
+    if(buf != task->batchBuf)
+    {
+        IscPoolFree(buf);
+    }
+    return 1;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  retry the held write once its backoff expired, a ISC_TX_EVENT
+ *         clears the backoff
+ *
+ * @retval 1 if nothing is held any more and the queue may be drained
+ */
+/* ----------------------------------------------------------------------------*/
+static uint8 IscWriteRetry(IscThreadEntry* task, uint32 channel)
+{
+    if(task->retryMsg == NULL)
+        return 1;
+
+    if(IscTimeNowNs() < task->retryAtNs)
+        return 0;
+
+    ISCLOGT("%s id %d retry %d", __func__, task->id, task->retryCount);
+    IscStatsRetry(task->id);
+    return IscWriteSend(task, channel, task->retryMsg, task->retryLen, task->retryFrames, \
+                        task->retryStampNs);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  next message for the batch, the one set aside while a batch was
+ *         held goes first
+ */
+/* ----------------------------------------------------------------------------*/
+static uint8 IscWriteNext(IscThreadEntry* task, uint8 **msg, uint16* len, uint64_t* stampNs)
+{
+    if(task->heldMsg != NULL)
+    {
+        *msg = task->heldMsg;
+        *len = task->heldLen;
+        *stampNs = task->heldStampNs;
+        task->heldMsg = NULL;
+        return 0x00;
+    }
+    return IscGetOneMessage(task, msg, len, stampNs);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  drain the write queue into framed batches, one IscWrite per batch.
+ *         A partial batch waits once for up to batchLingerMs for more.
+ *
+ * @param task
+ * @param channel
+ * @param linger  0 to flush a partial batch right away
+ *
+ * @retval ISC_EXIT_EVENT if it came while lingering, messages and flush
+ *         requests that ended the linger are already served
+ */
+/* ----------------------------------------------------------------------------*/
+static uint32 IscWriteBatched(IscThreadEntry* task, uint32 channel, uint8 linger)
+{
+    const ISC_CHANNEL_CONFIG_T* cfg = &(ChannelConfig[task->id][ISC_WR_TASK]);
+    uint8 id = task->id;
+    uint8* message = NULL;
+    uint16 len = 0;
+    uint32 used = 0;
+    uint16 frames = 0;
+    uint64_t stampNs = 0;
+    uint64_t oldestNs = 0;   /*of the batch being filled*/
+    uint32 eventBits = 0;
+    uint8 lingered = 0;
+
+    if(!IscWriteRetry(task, channel))
+    {
+        return 0;
+    }
+
+    for(;;)
+    {
+        if(IscWriteNext(task, &message, &len, &stampNs) != 0x00)
+        {
+            if(used == 0 || lingered || !linger || cfg->batchLingerMs == 0)
+            {
+                break;
+            }
+            lingered = 1;
+            if(IscWriterPark(task, ISC_WRITER_LINGER))
+            {
+                /*ended early by more messages or a flush request*/
+                (void) IscEventWaitMask(&(task->handle), ISC_WR_EVENTS, ISC_EVENT_WAIT_ANY, \
+                                        cfg->batchLingerMs, &eventBits);
+                eventBits = IscWriterUnpark(task, eventBits);
+            }
+            if(eventBits & ISC_EXIT_EVENT)
+            {
+                break;
+            }
+            continue;
+        }
+
+        if(used + ISC_BATCH_HDR_SIZE + len > cfg->batchBytes)
+        {
+            if(used != 0)
             {
-                if(msg)
+                ISCLOGT("%s,*********Write batch*****,%d,len %d",__func__, id, used);
+                if(!IscWriteSend(task, channel, task->batchBuf, used, frames, oldestNs))
                 {
+                    /*batch held, this message goes into the next one*/
+                    task->heldMsg = message;
+                    task->heldLen = len;
+                    task->heldStampNs = stampNs;
+                    return eventBits & ISC_EXIT_EVENT;
+                }
+                used = 0;
+                frames = 0;
+                lingered = 0;
+            }
+            if(ISC_BATCH_HDR_SIZE + len > cfg->batchBytes)
+            {
+                /*larger than a batch, frame it alone*/
+                uint8* single = NULL;
+                if(len <= 0xFFFF - ISC_BATCH_HDR_SIZE)
+                {
+                    single = (uint8*) IscPoolAlloc(id, ISC_BATCH_HDR_SIZE + len);
+                }
+                if(single == NULL)
+                {
+                    IscPoolFree(message);
+                    __atomic_fetch_add(&(queueStats[id].discarded), 1, __ATOMIC_RELAXED);
+                    continue;
+                }
+                single[0] = (uint8)(len & 0xFF);
+                single[1] = (uint8)(len >> 8);
+                memcpy(&single[ISC_BATCH_HDR_SIZE], message, len);
+                IscPoolFree(message);
+                if(!IscWriteSend(task, channel, single, ISC_BATCH_HDR_SIZE + len, 1, stampNs))
+                {
+                    return eventBits & ISC_EXIT_EVENT;
+                }
+                continue;
+            }
+        }
+
+        if(used == 0)
+        {
+            oldestNs = stampNs;
+        }
+        task->batchBuf[used] = (uint8)(len & 0xFF);
+        task->batchBuf[used + 1] = (uint8)(len >> 8);
+        memcpy(&(task->batchBuf[used + ISC_BATCH_HDR_SIZE]), message, len);
+        used += ISC_BATCH_HDR_SIZE + len;
+        frames++;
+        IscPoolFree(message);
+    }
+
+    if(used != 0)
+    {
+        ISCLOGT("%s,*********Write batch*****,%d,len %d",__func__, id, used);
+        (void) IscWriteSend(task, channel, task->batchBuf, used, frames, oldestNs);
+    }
+    return eventBits & ISC_EXIT_EVENT;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  write everything queued for the task, stops at a write the peer
+ *         has no room for
+ *
+ * @param task
+ * @param channel
+ * @param linger  1 if a partial batch may block the caller for batchLingerMs
+ *
+ * @retval ISC_EXIT_EVENT if it came while lingering
+ */
+/* ----------------------------------------------------------------------------*/
+uint32 IscWriteDrain(IscThreadEntry* task, uint32 channel, uint8 linger)
+{
+    uint8 id = task->id;
+    uint8* message = NULL;
+    uint16 len;
+    uint64_t stampNs = 0;
+
+    if(task->batchBuf != NULL)
+    {
+        return IscWriteBatched(task, channel, linger);
+    }
+    if(!IscWriteRetry(task, channel))
+    {
+        return 0;
+    }
+    while(IscGetOneMessage(task, &message, &len, &stampNs) == 0x00)
+    {
+        if(ISC_MSG_TRACE_ON())
+        {
+            IscTraceMessage(id, ISC_TRACE_WRITE, message, len);
+        }
+        if(!IscWriteSend(task, channel, message, len, 1, stampNs))
+        {
+            break;
+        }
+        message = NULL;
+    }
+    return 0;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  free everything still queued for the task
+ */
+/* ----------------------------------------------------------------------------*/
+void IscWriteDiscard(IscThreadEntry* task)
+{
+    uint8* message = NULL;
+    uint16 len;
+    uint8 lane;
+
+    if(task->retryMsg != NULL)
+    {
+        if(task->retryMsg != task->batchBuf)
+        {
+            IscPoolFree(task->retryMsg);
+        }
+        __atomic_fetch_add(&(queueStats[task->id].discarded), task->retryFrames, __ATOMIC_RELAXED);
+        task->retryMsg = NULL;
+    }
+    if(task->heldMsg != NULL)
+    {
+        IscPoolFree(task->heldMsg);
+        __atomic_fetch_add(&(queueStats[task->id].discarded), 1, __ATOMIC_RELAXED);
+        task->heldMsg = NULL;
+    }
+    for(lane = 0; lane < ISC_PRIO_LANES; lane++)
+    {
+        while(IscLanePop(task, lane, &message, &len, NULL) == 0x00)
+        {
+            IscPoolFree(message);
+            message = NULL;
+            __atomic_fetch_add(&(queueStats[task->id].discarded), 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  anything for the write task to do besides a held write
+ */
+/* ----------------------------------------------------------------------------*/
+uint8 IscWriterHasWork(IscThreadEntry* task)
+{
+    return (task->heldMsg != NULL) || \
+           (__atomic_load_n(&(task->queuedBytes), __ATOMIC_SEQ_CST) != 0);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  tell senders the write task is about to sleep, so the next one
+ *         sets ISC_MSG_EVENT. The queue is checked after the flag is up:
+ *         a sender that queued before it is seen here, one after it sees
+ *         the flag.
+ *
+ * @param how  ISC_WRITER_IDLE, or ISC_WRITER_LINGER while a partial batch
+ *             waits, then IscSendFlush wakes the task too
+ *
+ * @retval 1 if the task may sleep, 0 if messages came in meanwhile
+ */
+/* ----------------------------------------------------------------------------*/
+uint8 IscWriterPark(IscThreadEntry* task, uint8 how)
+{
+    __atomic_store_n(&(task->writerIdle), how, __ATOMIC_SEQ_CST);
+    if(!IscWriterHasWork(task))
+    {
+        return 1;
+    }
+    (void) IscWriterUnpark(task, 0);
+    return 0;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  write task awake again: take the parked flag back. If a sender
+ *         or IscSendFlush took it first, its event is on the way; collect
+ *         it now rather than be woken by it for work already done.
+ *
+ * @param eventBits  what woke the task
+ *
+ * @retval eventBits with the collected event
+ */
+/* ----------------------------------------------------------------------------*/
+static uint32 IscWriterUnpark(IscThreadEntry* task, uint32 eventBits)
+{
+    uint32 bits = 0;
+
+    if(!__atomic_exchange_n(&(task->writerIdle), ISC_WRITER_BUSY, __ATOMIC_SEQ_CST) && \
+       !(eventBits & (ISC_MSG_EVENT | ISC_FLUSH_EVENT)))
+    {
+        (void) IscEventWaitMask(&(task->handle), ISC_MSG_EVENT | ISC_FLUSH_EVENT, ISC_EVENT_WAIT_ANY, \
+                                ISC_EVENT_WAIT_INFINITE, &bits);
+    }
+    return eventBits | bits;
+}
+
+/* only the sender that finds the write task parked wakes it. queuedBytes
+   drops only after a pop, so at 0 the task already took this message */
+static void IscWriterKick(IscThreadEntry* task)
+{
+    if(__atomic_load_n(&(task->queuedBytes), __ATOMIC_SEQ_CST) == 0)
+    {
+        return;
+    }
+    if(__atomic_exchange_n(&(task->writerIdle), ISC_WRITER_BUSY, __ATOMIC_SEQ_CST))
+    {
+        IscTaskWake(task, ISC_MSG_EVENT);
+    }
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  on exit: keep writing until the queue is empty or drainUntilNs
+ *         passed, then free what is left
+ */
+/* ----------------------------------------------------------------------------*/
+void IscWriteFlush(IscThreadEntry* task, uint32 channel)
+{
+    uint64_t deadlineNs = task->drainUntilNs;
 
-                    *msg = (uint8*)(message->message);
+    while(deadlineNs != 0)
+    {
+        (void) IscWriteDrain(task, channel, 0);
+        if(task->retryMsg == NULL || IscTimeNowNs() >= deadlineNs)
+        {
+            break;
+        }
+        /*peer full, wait out the backoff but not past the deadline*/
+        IscThreadSleepUntil((task->retryAtNs < deadlineNs) ? task->retryAtNs : deadlineNs);
+    }
+    IscWriteDiscard(task);
+}
+
+void IscAsyncWriteTaskLoop(void* data)
+{
+    IscThreadEntry* task = (IscThreadEntry*)data;
+    IscResult result;
+    uint8 id = task->id;
+    uint32 eventBits = 0;
+    uint32 pendingBits = 0;
+
+    uint32 channel = ChannelMatrix[id][ISC_WR_TASK].ch;
+    if(channel == INVALID_CHANNEL)
+    {
+        ISCLOGI("Func: %s,ch:%x if invalid!", __func__,channel);
+        return;
+    }
+    IscSetTaskName(id,ISC_WR_TASK);
+    ISCLOGI("Func: %s", __func__);
+    task->running = 1;
+    /*set thread name todo */
+    if(task != NULL)
+    {
+        while(task->running)
+        {
+            /*exit picked up while a batch was lingering*/
+            eventBits = pendingBits;
+            pendingBits = 0;
+            result = ISC_RESULT_SUCCESS;
+            if(eventBits == 0 && task->retryMsg != NULL)
+            {
+                /*peer had no room: new messages wait behind the held one,
+                  only its backoff, room on the peer or exit end the wait*/
+                result = IscEventWaitUntil(&(task->handle), ISC_EXIT_EVENT | ISC_TX_EVENT, \
+                                           ISC_EVENT_WAIT_ANY, task->retryAtNs, &eventBits);
+                if(result == ISC_RESULT_TIMEOUT)
+                {
+                    result = ISC_RESULT_SUCCESS;
+                    eventBits = TIMEOUT_EVENT;
                 }
-                if(len)
+            }
+            else if(eventBits == 0)
+            {
+                if(!IscWriterPark(task, ISC_WRITER_IDLE))
                 {
-                    *len = message->event;
+                    /*queued while we were busy, no wakeup needed*/
+                    pendingBits = IscWriteDrain(task, channel, 1);
+                    continue;
                 }
+                result = IscEventWaitMask(&(task->handle), ISC_WR_EVENTS, ISC_EVENT_WAIT_ANY, \
+                                          ISC_EVENT_WAIT_INFINITE, &eventBits);
+                eventBits = IscWriterUnpark(task, eventBits);
+            }
+            if(result != ISC_RESULT_SUCCESS || eventBits == 0)
+            {
+                continue;
+            }
+            /*exit event*/
+            if(eventBits & ISC_EXIT_EVENT)
+            {
+                task->running = 0;
+                /*exit task*/
+                IscWriteFlush(task, channel);
+                break;
+            }
+            if(eventBits & ISC_TX_EVENT)
+            {
+                task->retryAtNs = 0;
+            }
+            if(eventBits & TIMEOUT_EVENT)
+            {
+                /*not a wakeup, the held write is due*/
+                pendingBits = IscWriteDrain(task, channel, 1);
+                continue;
+            }
+            IscStatsWakeup(id, (task->retryMsg != NULL) ? ((eventBits & ISC_TX_EVENT) != 0) : \
+                               IscWriterHasWork(task));
+            if(eventBits & (ISC_MSG_EVENT | ISC_TX_EVENT | ISC_FLUSH_EVENT))
+            {
+                ISCLOGT("**********************%s id %d  task  %p ********************", __func__, id, task);
+                /*a flush request sends the partial batch without lingering*/
+                pendingBits = IscWriteDrain(task, channel, (eventBits & ISC_FLUSH_EVENT) ? 0 : 1);
+            }
+        }
+    }
+
+ISCLOGT("%s,@@@@@@@@@@@@@@EXIT FUNCION,id:%d",__func__,id);
+
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  take the oldest message of one lane, called by the write task
+ *         and by senders evicting the oldest message
+ */
+/* ----------------------------------------------------------------------------*/
+static uint8 IscLanePop(IscThreadEntry* task, uint8 lane, uint8 **msg, uint16* len, uint64_t* stampNs)
+{
+    if(IscRingPop(&(task->mQueue[lane]), msg, len, stampNs) != ISC_RESULT_SUCCESS)
+    {
+        return 0xFF;
+    }
+    (void) __atomic_sub_fetch(&(task->queuedBytes), *len, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&(task->spaceWaiters), __ATOMIC_SEQ_CST) != 0)
+    {
+        IscEventSet(&(task->spaceHandle), ISC_SPACE_EVENT);
+    }
+    return 0x00;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  next message for the write task: the first non-empty lane in
+ *         priority order, or weighted round robin when the channel has
+ *         lane weights
+ *
+ * @param stampNs  enqueue time of the message
+ */
+/* ----------------------------------------------------------------------------*/
+static uint8 IscGetOneMessage(IscThreadEntry * task, uint8 **msg, uint16* len, uint64_t* stampNs)
+{
+    const uint8* weight = ChannelConfig[task->id][ISC_WR_TASK].laneWeight;
+    uint8 lane = ISC_PRIO_LANES;
+    uint8 k;
+
+    if((weight[0] | weight[1] | weight[2]) == 0)
+    {
+        for(k = 0; k < ISC_PRIO_LANES; k++)
+        {
+            if(IscLanePop(task, laneOrder[k], msg, len, stampNs) == 0x00)
+            {
+                lane = laneOrder[k];
+                break;
             }
-            task->mQueueFirst = message->next;
-            if(task->mQueueLast == message)
+        }
+    }
+    else
+    {
+        /*stay on a lane until its credit is spent or it runs empty*/
+        for(k = 0; k <= ISC_PRIO_LANES; k++)
+        {
+            uint8 cur = laneOrder[task->laneCursor];
+            if(task->laneCredit != 0 && IscLanePop(task, cur, msg, len, stampNs) == 0x00)
             {
-                task->mQueueLast = NULL;
+                task->laneCredit--;
+                lane = cur;
+                break;
             }
-            message->next = NULL;
-            /*IscFree message*/
-            IscFree(message);
-            flag = 0x00;
+            task->laneCursor = (task->laneCursor + 1) % ISC_PRIO_LANES;
+            task->laneCredit = weight[laneOrder[task->laneCursor]];
+            if(task->laneCredit == 0)
+                task->laneCredit = 1;
         }
-        IscMutexUnlock(&(task->mMutex));
     }
-    return flag;
+
+    if(lane == ISC_PRIO_LANES)
+    {
+        return 0xFF;
+    }
+
+    {
+        IscLaneCounters* lc = &(laneStats[task->id][lane]);
+        uint64_t waitNs = IscTimeNowNs() - *stampNs;
+        uint32 waitUs = (uint32)(waitNs / 1000);
+        uint32 maxUs = __atomic_load_n(&(lc->waitMaxUs), __ATOMIC_RELAXED);
+
+        __atomic_fetch_add(&(lc->sent), 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&(lc->waitNs), waitNs, __ATOMIC_RELAXED);
+        if(waitUs > maxUs)
+        {
+            __atomic_store_n(&(lc->waitMaxUs), waitUs, __ATOMIC_RELAXED);
+        }
+    }
+    return 0x00;
 }
 
-static void IscPutMessage(uint8 id, uint8* msg, uint16 len)
-{
-    if(id > ISC_MAX_ID)
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  queue a message on its lane if both the slot and the byte limit
+ *         allow it. A message alone in the queue may exceed queueBytes.
+ */
+/* ----------------------------------------------------------------------------*/
+static uint8 IscTryPutMessage(IscThreadEntry* task, uint8 lane, uint8* msg, uint16 len)
+{
+    uint32 limit = ChannelConfig[task->id][ISC_WR_TASK].queueBytes;
+    uint32 queued = __atomic_add_fetch(&(task->queuedBytes), len, __ATOMIC_SEQ_CST);
+    IscLaneCounters* lc = &(laneStats[task->id][lane]);
+    uint32 depth;
+    uint32 high;
+    uint8 k;
+
+    if((limit != 0 && queued > limit && queued != len) || \
+       IscRingPush(&(task->mQueue[lane]), msg, len, IscTimeNowNs()) != ISC_RESULT_SUCCESS)
+    {
+        (void) __atomic_sub_fetch(&(task->queuedBytes), len, __ATOMIC_SEQ_CST);
+        return 0;
+    }
+
+    depth = IscRingCount(&(task->mQueue[lane]));
+    high = __atomic_load_n(&(lc->highWater), __ATOMIC_RELAXED);
+    while(depth > high && \
+          !__atomic_compare_exchange_n(&(lc->highWater), &high, depth, 1, \
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+
+    for(k = 0; k < ISC_PRIO_LANES; k++)
+    {
+        if(k != lane)
+            depth += IscRingCount(&(task->mQueue[k]));
+    }
+    IscStatsQueueDepth(task->id, depth, queued);
+    return 1;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  drop the oldest message of the lowest lane that is not above
+ *         the sender's, so bulk traffic never evicts control frames
+ *
+ * @retval 1 if a message was dropped
+ */
+/* ----------------------------------------------------------------------------*/
+static uint8 IscEvictOldest(IscThreadEntry* task, uint8 lane)
+{
+    uint8* old = NULL;
+    uint16 oldLen = 0;
+    uint8 k;
+
+    for(k = ISC_PRIO_LANES; k > laneRank[lane]; k--)
+    {
+        if(IscLanePop(task, laneOrder[k - 1], &old, &oldLen, NULL) == 0x00)
+        {
+            IscPoolFree(old);
+            __atomic_fetch_add(&(queueStats[task->id].evicted), 1, __ATOMIC_RELAXED);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int8 IscPutMessage(uint8 id, uint8* msg, uint16 len, const ISC_SEND_OPTIONS_T* opt)
+{
+    uint8 mode = (opt != NULL) ? opt->mode : ISC_SEND_NONBLOCK;
+    uint8 lane = (opt != NULL) ? opt->priority : ISC_PRIO_NORMAL;
+    uint64_t deadlineNs = 0;
+
+    if(id >= ISC_MAX_CHANNELS || lane >= ISC_PRIO_LANES)
+    {
+        ISCLOGE("**********************%s id %d lane %d over", __func__, id, lane);
+        IscPoolFree(msg);
+        return ISC_ERR_DINVAL;
+    }
+
+    IscThreadEntry* task = IscTaskAcquire(id, ISC_WR_TASK);
+    if(task == NULL)
     {
-        ISCLOGE("**********************%s id %d  over", __func__, id);
-        return;
+        IscPoolFree(msg);
+        return ISC_INVALID_CHANNEL;
     }
 
-    IscThreadEntry* task = mThreadEntry[id][ISC_WR_TASK];
-    if(task != NULL)
+    ISCLOGT("**********************%s id %d  task  %p ********************", __func__, id, task);
+    for(;;)
     {
-        IscMsgQueueEntry* message = (IscMsgQueueEntry*)IscMalloc(sizeof(IscMsgQueueEntry));
-        if(message != NULL)
+        if(__atomic_load_n(&(task->closing), __ATOMIC_SEQ_CST))
         {
-            message->message = msg;
-            message->next = NULL;
-            message->event = len;
-        }else
+            IscTaskRelease(id);
+            IscPoolFree(msg);
+            return ISC_INVALID_CHANNEL;
+        }
+        if(IscTryPutMessage(task, lane, msg, len))
         {
-            IscFree(msg);
-            return;
+            IscWriterKick(task);
+            IscTaskRelease(id);
+            return ISC_SUCCESS;
         }
-        ISCLOGT("**********************%s id %d  task  %p ********************", __func__, id, task);
-        IscMutexLock(&(task)->mMutex);
-        if(task->mQueueLast == NULL)
+
+        if(mode == ISC_SEND_DROP_OLDEST && IscEvictOldest(task, lane))
         {
-            task->mQueueFirst = message;
-            task->mQueueLast = message;
-        }else
+            continue;
+        }
+
+        if(mode != ISC_SEND_BLOCK || opt->timeoutMs == 0)
         {
-            task->mQueueLast->next = message;
-            task->mQueueLast = message;
+            __atomic_fetch_add(&(queueStats[id].rejected), 1, __ATOMIC_RELAXED);
+            break;
         }
-        IscMutexUnlock(&(task->mMutex));
-        IscEventSet(&(task->handle), ISC_MSG_EVENT);
 
+        if(deadlineNs == 0)
+        {
+            deadlineNs = (opt->timeoutMs == ISC_SEND_WAIT_INFINITE) ? ISC_TIME_INFINITE : \
+                         IscTimeNowNs() + (uint64_t)opt->timeoutMs * 1000000ULL;
+        }
+        /*register before the last try, the write task checks for waiters after each pop*/
+        (void) __atomic_fetch_add(&(task->spaceWaiters), 1, __ATOMIC_SEQ_CST);
+        /*deinit wakes registered waiters only: look again after registering*/
+        if(__atomic_load_n(&(task->closing), __ATOMIC_SEQ_CST))
+        {
+            (void) __atomic_fetch_sub(&(task->spaceWaiters), 1, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        if(IscTryPutMessage(task, lane, msg, len))
+        {
+            (void) __atomic_fetch_sub(&(task->spaceWaiters), 1, __ATOMIC_SEQ_CST);
+            IscWriterKick(task);
+            IscTaskRelease(id);
+            return ISC_SUCCESS;
+        }
+        uint32 eventBits = 0;
+        IscResult result = IscEventWaitUntil(&(task->spaceHandle), ISC_SPACE_EVENT, \
+                                             ISC_EVENT_WAIT_ANY, deadlineNs, &eventBits);
+        (void) __atomic_fetch_sub(&(task->spaceWaiters), 1, __ATOMIC_SEQ_CST);
+        if(result != ISC_RESULT_SUCCESS)
+        {
+            __atomic_fetch_add(&(queueStats[id].timedOut), 1, __ATOMIC_RELAXED);
+            break;
+        }
     }
-    else
+
+    IscTaskRelease(id);
+    ISCLOGE("%s id %d write queue full", __func__, id);
+    IscPoolFree(msg);
+    return ISC_ERR_QUEUE_FULL;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  1 if messages of id sent with mix_id carry the mix_id byte:
+ *         always on ISC_MIX_ID, where 0 marks a message of no sub-channel,
+ *         elsewhere only for a non-zero mix_id
+ */
+/* ----------------------------------------------------------------------------*/
+static inline uint8 IscMixHeader(uint8 id, uint8 mix_id)
+{
+    return (mix_id != 0) || (id == ISC_MIX_ID);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  reserve a write buffer, the mix_id header is already in place
+ *
+ * @param id
+ * @param mix_id  0 for channels without mix header
+ * @param length  max payload bytes the caller will write
+ *
+ * @retval  pointer to the payload area, NULL on error
+ */
+/* ----------------------------------------------------------------------------*/
+uint8* IscSendReserve(uint8 id, uint8 mix_id, uint16 length)
+{
+    uint8* msg = NULL;
+    uint32 len = length;
+    if(IscMixHeader(id, mix_id))
+    {
+        len = length + 1;/*1 byte to same mix_id*/
+    }
+
+    if(id >= ISC_MAX_CHANNELS || len > 0xFFFF)
+        return NULL;
+
+    /*a full peer (ISC_ERR_NOMEM) is absorbed by the bounded write queue*/
+    if(iscWriteRes[id] < 0 && iscWriteRes[id] != ISC_ERR_NOMEM)
+        return NULL;
+
+    msg = (uint8*) IscPoolAlloc(id, len);
+    if(msg == NULL)
+        return NULL;
+
+    /*for mix channel to same the mix id*/
+    if(IscMixHeader(id, mix_id))
+    {
+        msg[0] = mix_id;
+        return &msg[1];
+    }
+    return msg;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  queue a buffer from IscSendReserve, the writer hands it to
+ *         IscWrite as is. The buffer belongs to the ISC layer afterwards,
+ *         even on error.
+ *
+ * @param id
+ * @param mix_id  same value as given to IscSendReserve
+ * @param buf     pointer returned by IscSendReserve
+ * @param length  payload bytes written, not more than reserved
+ *
+ * @retval  ISC_ERR_DINVAL if buf was not reserved on id and mix_id or length
+ *          is more than reserved; a buffer of another id is left untouched
+ */
+/* ----------------------------------------------------------------------------*/
+uint8 IscSendCommit(uint8 id, uint8 mix_id, uint8* buf, uint16 length)
+{
+    return IscSendCommitEx(id, mix_id, buf, length, NULL);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  IscSendCommit with a full-queue policy
+ *
+ * @param opt  NULL for ISC_SEND_NONBLOCK
+ */
+/* ----------------------------------------------------------------------------*/
+uint8 IscSendCommitEx(uint8 id, uint8 mix_id, uint8* buf, uint16 length, \
+                      const ISC_SEND_OPTIONS_T* opt)
+{
+    uint8* msg = buf;
+    uint32 len = length;
+    uint8 owner = ISC_MAX_CHANNELS;
+    uint32 reserved = 0;
+
+    if(buf == NULL)
+        return ISC_ERR_DINVAL;
+
+    if(IscMixHeader(id, mix_id))
+    {
+        msg = buf - 1;
+        len = length + 1;
+    }
+    (void) IscPoolGetInfo(msg, &owner, &reserved);
+    if(owner != id)
     {
-        IscFree(msg);
+        ISCLOGE("%s id %d buffer %p not reserved on this id", __func__, id, buf);
+        return ISC_ERR_DINVAL;
+    }
+    if(len > reserved)
+    {
+        ISCLOGE("%s id %d length %d over reserved %d", __func__, id, len, reserved);
+        IscPoolFree(msg);
+        return ISC_ERR_DINVAL;
     }
+    if(msg != buf && msg[0] != mix_id)
+    {
+        ISCLOGE("%s id %d mix_id %d reserved as %d", __func__, id, mix_id, msg[0]);
+        IscPoolFree(msg);
+        return ISC_ERR_DINVAL;
+    }
+    ISCLOGT("%s message %p length %d", __func__, msg, len);
+    return IscPutMessage(id, msg, len, opt);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  give back a buffer from IscSendReserve without sending it
+ *
+ * @param id      same value as given to IscSendReserve
+ * @param mix_id  same value as given to IscSendReserve
+ * @param buf     pointer returned by IscSendReserve
+ */
+/* ----------------------------------------------------------------------------*/
+void IscSendCancel(uint8 id, uint8 mix_id, uint8* buf)
+{
+    if(buf == NULL)
+        return;
+
+    IscPoolFree(IscMixHeader(id, mix_id) ? buf - 1 : buf);
 }
 
 /* --------------------------------------------------------------------------*/
@@ -342,42 +1553,126 @@ static void IscPutMessage(uint8 id, uint8* msg, uint16 len)
  */
 /* ----------------------------------------------------------------------------*/
 uint8 IscSendMessage(uint8 id, uint8 mix_id,  uint8* message, uint16 length)
+{
+    return IscSendMessageEx(id, mix_id, message, length, NULL);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  send message to the read, opt decides what happens when the
+ *         write queue of id is full
+ *
+ * @param opt  NULL for ISC_SEND_NONBLOCK
+ *
+ * @retval ISC_ERR_QUEUE_FULL if the message was not queued
+ */
+/* ----------------------------------------------------------------------------*/
+uint8 IscSendMessageEx(uint8 id, uint8 mix_id, uint8* message, uint16 length, \
+                       const ISC_SEND_OPTIONS_T* opt)
 {
     uint8* msg = NULL;
-    uint16 len = length;
-    if(mix_id != 0)
-    {
-        len = length + 1;/*1 byte to same mix_id*/
-    }
 
-    if(iscWriteRes[id] < 0)
+    if(id >= ISC_MAX_CHANNELS)
+        return ISC_ERR_DINVAL;
+
+    if(iscWriteRes[id] < 0 && iscWriteRes[id] != ISC_ERR_NOMEM)
         return iscWriteRes[id];
 
-    msg = (uint8*) IscMalloc(len);
-    if(msg != NULL && message != NULL)
+    if(message == NULL)
+        return ISC_ERR_ALLOC;
+
+    msg = IscSendReserve(id, mix_id, length);
+    if(msg != NULL)
     {
-        char tmp[224];
-        memset(tmp, 0, sizeof(tmp));
-        API_BUFFER_DUMP(tmp, 1024, message, length);
-        ISCLOGT("*********Write*****%s", tmp);
-        /*for mix channel to same the mix id*/
-        if(mix_id != 0)
+        if(ISC_MSG_TRACE_ON())
         {
-            msg[0] = mix_id;
-            memcpy(&msg[1], message, length);
+            IscTraceMessage(id, ISC_TRACE_SEND, message, length);
         }
-        else
-        {
-
-            memcpy(&msg[0], message, length);
-        }
-        ISCLOGT("%s message %p length %d", __func__, msg, len);
-        IscPutMessage(id, msg, len);
-        return ISC_SUCCESS;
+        memcpy(msg, message, length);
+        return IscSendCommitEx(id, mix_id, msg, length, opt);
     }
     return ISC_ERR_ALLOC;
 }
 
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  send what the write task of id holds back for a partial batch
+ *         now instead of waiting out batchLingerMs, no wakeup if it holds
+ *         nothing back
+ *
+ * @retval ISC_INVALID_CHANNEL if id has no write task
+ */
+/* ----------------------------------------------------------------------------*/
+uint8 IscSendFlush(uint8 id)
+{
+    IscThreadEntry* task = IscTaskAcquire(id, ISC_WR_TASK);
+    uint8 how = ISC_WRITER_LINGER;
+
+    if(task == NULL)
+        return ISC_INVALID_CHANNEL;
+    /*only a lingering writer holds anything back*/
+    if(__atomic_compare_exchange_n(&(task->writerIdle), &how, ISC_WRITER_BUSY, 0, \
+                                   __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+    {
+        IscTaskWake(task, ISC_FLUSH_EVENT);
+    }
+    IscTaskRelease(id);
+    return ISC_SUCCESS;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  snapshot of the write queue fill level, drop counters and
+ *         per lane depth and wait time of id
+ */
+/* ----------------------------------------------------------------------------*/
+uint8 IscGetQueueStats(uint8 id, ISC_QUEUE_STATS_T* stats)
+{
+    IscThreadEntry* task;
+    uint8 lane;
+
+    if(id >= ISC_MAX_CHANNELS || stats == NULL)
+        return ISC_ERR_DINVAL;
+
+    task = IscTaskAcquire(id, ISC_WR_TASK);
+    stats->queued = 0;
+    for(lane = 0; lane < ISC_PRIO_LANES; lane++)
+    {
+        IscLaneCounters* lc = &(laneStats[id][lane]);
+        ISC_LANE_STATS_T* ls = &(stats->lane[lane]);
+        uint64_t waitNs = __atomic_load_n(&(lc->waitNs), __ATOMIC_RELAXED);
+
+        ls->depth = (task != NULL) ? IscRingCount(&(task->mQueue[lane])) : 0;
+        ls->highWater = __atomic_load_n(&(lc->highWater), __ATOMIC_RELAXED);
+        ls->sent = __atomic_load_n(&(lc->sent), __ATOMIC_RELAXED);
+        ls->waitAvgUs = (ls->sent != 0) ? (uint32)(waitNs / ls->sent / 1000) : 0;
+        ls->waitMaxUs = __atomic_load_n(&(lc->waitMaxUs), __ATOMIC_RELAXED);
+        stats->queued += ls->depth;
+    }
+    stats->queuedBytes = (task != NULL) ? __atomic_load_n(&(task->queuedBytes), __ATOMIC_RELAXED) : 0;
+    stats->rejected = __atomic_load_n(&(queueStats[id].rejected), __ATOMIC_RELAXED);
+    stats->timedOut = __atomic_load_n(&(queueStats[id].timedOut), __ATOMIC_RELAXED);
+    stats->evicted = __atomic_load_n(&(queueStats[id].evicted), __ATOMIC_RELAXED);
+    stats->discarded = __atomic_load_n(&(queueStats[id].discarded), __ATOMIC_RELAXED);
+    if(task != NULL)
+        IscTaskRelease(id);
+    return ISC_SUCCESS;
+}
+
+void IscSetMsgTrace(uint8 enable)
+{
+#ifndef ISC_NO_MSG_TRACE
+    __atomic_store_n(&iscMsgTrace, (uint8)(enable != 0), __ATOMIC_RELAXED);
+#else
+    (void) enable;
+#endif
+}
+
+uint8 IscGetMsgTrace(void)
+{
+    return ISC_MSG_TRACE_ON();
+}
+
 int16 IscDirectWrite(uint8 id, uint8_t* buf, uint16_t bufLen)
 {
     uint32 channel = ChannelMatrix[id][ISC_WR_TASK].ch;
@@ -395,15 +1690,174 @@ int16 IscDirectRead(uint id, uint8_t *buf)
 }
 
 
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  set event bits of a task and kick its wake fd, if it has one
+ */
+/* ----------------------------------------------------------------------------*/
+void IscTaskWake(IscThreadEntry *task, uint32 eventBits)
+{
+	if(task == NULL)
+		return;
+	IscEventSet(&(task->handle), eventBits);
+#ifdef ISC_HAVE_EVENTFD
+	/*one write until the waiter re-arms, not one per event*/
+	if(task->wakeFd >= 0 && \
+	   __atomic_exchange_n(&(task->wakePending), 1, __ATOMIC_SEQ_CST) == 0)
+	{
+		uint64_t one = 1;
+		(void) write(task->wakeFd, &one, sizeof(one));
+	}
+#endif
+}
+
 void IscexitThread(IscThreadEntry *task)
 {
 	 if(task == NULL)
 		return;
-	IscEventSet(&(task->handle), ISC_EXIT_EVENT);
+	IscTaskWake(task, ISC_EXIT_EVENT);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  backend hook for ISC_READY_NOTIFY channels: data was posted
+ *
+ * @param id
+ */
+/* ----------------------------------------------------------------------------*/
+void IscNotifyReadable(uint8 id)
+{
+	IscThreadEntry* task = IscTaskAcquire(id, ISC_RD_TASK);
+
+	if(task == NULL)
+		return;
+	IscTaskWake(task, ISC_RX_EVENT);
+	IscTaskRelease(id);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  backend hook: the peer freed room after IscWrite returned
+ *         ISC_ERR_NOMEM, the held write is retried without waiting out
+ *         its backoff
+ *
+ * @param id
+ */
+/* ----------------------------------------------------------------------------*/
+void IscNotifyWritable(uint8 id)
+{
+	IscThreadEntry* task = IscTaskAcquire(id, ISC_WR_TASK);
+
+	if(task == NULL)
+		return;
+	/*nothing held: the writer does not wait for room*/
+	if(__atomic_exchange_n(&(task->txWanted), 0, __ATOMIC_SEQ_CST))
+	{
+		IscTaskWake(task, ISC_TX_EVENT);
+	}
+	IscTaskRelease(id);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  backend hook for ISC_READY_FD channels: register the fd that
+ *         becomes readable when the peer posts data, -1 to go back to polling.
+ *         The fd stays the backend's, the ISC layer never closes it
+ *
+ * @param id
+ * @param fd
+ *
+ * @retval ISC_ERR_EXISTS if another fd is registered, set -1 first
+ */
+/* ----------------------------------------------------------------------------*/
+uint8 IscSetReadyFd(uint8 id, int fd)
+{
+	IscThreadEntry* task;
+	int old = -1;
+
+	if(id >= ISC_MAX_CHANNELS || fd < -1)
+		return ISC_ERR_DINVAL;
+	task = IscTaskAcquire(id, ISC_RD_TASK);
+	if(task == NULL)
+		return ISC_INVALID_CHANNEL;
+	/*replacing it unseen would leave the old fd in poll or epoll*/
+	if(fd < 0)
+	{
+		__atomic_store_n(&(task->readyFd), -1, __ATOMIC_RELEASE);
+	}
+	else if(!__atomic_compare_exchange_n(&(task->readyFd), &old, fd, 0, \
+	                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) && old != fd)
+	{
+		IscTaskRelease(id);
+		return ISC_ERR_EXISTS;
+	}
+	/*let a reader stuck in the polling fallback pick it up*/
+	IscTaskWake(task, ISC_RX_EVENT);
+	IscTaskRelease(id);
+	return ISC_SUCCESS;
+}
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  backend hook for channels above ISC_MAX_NORMAL_CHANNEL: register
+ *         the function that makes a read blocked in the driver return, NULL
+ *         if the driver has none
+ *
+ * @param fn
+ */
+/* ----------------------------------------------------------------------------*/
+void IscSetReadUnblock(IscReadUnblock fn)
+{
+    __atomic_store_n(&readUnblock, fn, __ATOMIC_RELEASE);
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  interrupt a read blocked in channel, if the backend can
+ *
+ * @param channel
+ *
+ * @retval 1 if the backend was asked to, 0 without an IscSetReadUnblock hook
+ */
+/* ----------------------------------------------------------------------------*/
+uint8 IscUnblockRead(uint32 channel)
+{
+    IscReadUnblock fn = __atomic_load_n(&readUnblock, __ATOMIC_ACQUIRE);
+
+    if(fn == NULL)
+    {
+        return 0;
+    }
+    fn(channel);
+    return 1;
+}
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  clear what a previous user of id left behind, its tasks are gone
+ *
+ * @param id
+ */
+/* ----------------------------------------------------------------------------*/
+void IscThreadResetId(uint8 id)
+{
+    if(id >= ISC_MAX_CHANNELS)
+    {
+        return;
+    }
+    mReceiveCb[id] = NULL;
+    __atomic_store_n(&(mReceiveBufCb[id]), NULL, __ATOMIC_RELEASE);
+    __atomic_store_n(&(mReceiveBatch[id].cb), NULL, __ATOMIC_RELEASE);
+    mReceiveBatch[id].maxMsgs = 0;
+    mReceiveBatch[id].maxBytes = 0;
+    memset(&(queueStats[id]), 0, sizeof(queueStats[id]));
+    memset(laneStats[id], 0, sizeof(laneStats[id]));
+    /*a sticky error would fail the first sends of the next user*/
+    iscWriteRes[id] = ISC_SUCCESS;
 }
+
 uint8 IscRegisterCb(uint8 id, IscReceivedMsg cb)
 {
-    if(id < ISC_MAX_ID)
+    if(id < ISC_MAX_CHANNELS)
     {
         mReceiveCb[id] = cb;
     }
@@ -418,7 +1872,7 @@ uint8 IscRegisterCb(uint8 id, IscReceivedMsg cb)
 
 uint8 IscUnRegisterCb(uint8 id)
 {
-    if(id < ISC_MAX_ID)
+    if(id < ISC_MAX_CHANNELS)
     {
         mReceiveCb[id] = NULL;
     }
@@ -431,6 +1885,54 @@ uint8 IscUnRegisterCb(uint8 id)
     return ISC_SUCCESS;
 }
 
+uint8 IscRegisterBufCb(uint8 id, IscReceivedBuf cb)
+{
+    if(id >= ISC_MAX_CHANNELS)
+    {
+        ISCLOGE("%s, the param is invaild",__func__);
+        return ISC_ERR_DINVAL;
+    }
+    __atomic_store_n(&(mReceiveBufCb[id]), cb, __ATOMIC_RELEASE);
+    ISCLOGT("%s id %d register success", __func__, id);
+    return ISC_SUCCESS;
+}
+
+uint8 IscUnRegisterBufCb(uint8 id)
+{
+    return IscRegisterBufCb(id, NULL);
+}
+
+uint8 IscRegisterBatchCb(uint8 id, IscReceivedMsgBatch cb, uint16 maxMsgs, uint32 maxBytes)
+{
+    if(id >= ISC_MAX_CHANNELS || cb == NULL)
+    {
+        ISCLOGE("%s, the param is invaild",__func__);
+        return ISC_ERR_DINVAL;
+    }
+    if(maxMsgs == 0 || maxMsgs > ISC_RECV_BATCH_MAX)
+    {
+        maxMsgs = ISC_RECV_BATCH_MAX;
+    }
+    mReceiveBatch[id].maxMsgs = maxMsgs;
+    mReceiveBatch[id].maxBytes = maxBytes;
+    /*the reader picks the limits up with the callback*/
+    __atomic_store_n(&(mReceiveBatch[id].cb), cb, __ATOMIC_RELEASE);
+    ISCLOGT("%s id %d register success, %d msgs %u bytes", __func__, id, maxMsgs, maxBytes);
+    return ISC_SUCCESS;
+}
+
+uint8 IscUnRegisterBatchCb(uint8 id)
+{
+    if(id >= ISC_MAX_CHANNELS)
+    {
+        ISCLOGE("%s, the param is invaild",__func__);
+        return ISC_ERR_DINVAL;
+    }
+    __atomic_store_n(&(mReceiveBatch[id].cb), NULL, __ATOMIC_RELEASE);
+    ISCLOGT("%s id %d unregister success", __func__, id);
+    return ISC_SUCCESS;
+}
+
 #ifdef  __cplusplus
 }
 #endif
@@ -4,17 +4,87 @@
 #include "types.h"
 #include "CpuExt.h"
 #include "CpuIf.h"
+#include "CpuRing.h"
+#include "CpuBuffer.h"
 
 #ifdef  __cplusplus
 extern "C" {
 #endif
 
 #define ISC_DEFAULT_STACK_SIZE (1024*32)
+#define ISC_DEFAULT_QUEUE_CAPACITY 256
+#define ISC_DEFAULT_QUEUE_BYTES (64*1024)
+#define ISC_DEFAULT_POLL_US 3000
+
+#if defined(__linux__) && !defined(ISC_NO_EVENTFD)
+#define ISC_HAVE_EVENTFD 1
+#endif
+
+/* batch framing: 2 byte little endian length in front of every message */
+#define ISC_BATCH_HDR_SIZE 2
+
+#ifndef ISC_ERR_QUEUE_FULL
+#define ISC_ERR_QUEUE_FULL (-64)
+#endif
+#ifndef ISC_ERR_TIMEOUT
+#define ISC_ERR_TIMEOUT (-65)
+#endif
+#ifndef ISC_ERR_EXISTS
+#define ISC_ERR_EXISTS (-66)
+#endif
+
+/* IscThreadDeinit: how long the writer flushes its queue before the rest
+ * is discarded */
+#define ISC_DEINIT_DRAIN_MS     100
+/* how long deinit waits for a reader blocked in a channel above
+ * ISC_MAX_NORMAL_CHANNEL when the backend cannot interrupt the read */
+#define ISC_DEINIT_READ_WAIT_MS 100
 
 /* Event types */
-#define TIMEOUT_EVENT    0x00020000
+#define TIMEOUT_EVENT    0x00020000   /*write task: backoff of the held write ran out*/
 #define ISC_EXIT_EVENT 0x00400000
-#define ISC_MSG_EVENT    0x01000000
+#define ISC_MSG_EVENT    0x01000000   /*write task: messages queued while it was parked*/
+#define ISC_RX_EVENT     0x02000000
+#define ISC_SPACE_EVENT  0x04000000   /*on spaceHandle: the write queue has room*/
+#define ISC_TX_EVENT     0x08000000   /*backend: the peer has room again*/
+#define ISC_FLUSH_EVENT  0x10000000   /*write task: send a partial batch now*/
+#define ISC_DONE_EVENT   0x20000000   /*on doneHandle: the read task loop returned*/
+#define ISC_UNUSED_EVENT 0x40000000   /*deinit: the last user of the tasks left*/
+
+/* writerIdle: what the write task is doing */
+#define ISC_WRITER_BUSY      0   /*draining, senders need not wake it*/
+#define ISC_WRITER_IDLE      1   /*asleep on an empty queue*/
+#define ISC_WRITER_LINGER    2   /*asleep with a partial batch*/
+
+/* what the write task waits for, other bits never wake it */
+#define ISC_WR_EVENTS    (ISC_EXIT_EVENT | ISC_MSG_EVENT | ISC_TX_EVENT | ISC_FLUSH_EVENT)
+
+/* What IscSendMessageEx does when the write queue is full */
+#define ISC_SEND_NONBLOCK    0   /*return ISC_ERR_QUEUE_FULL at once*/
+#define ISC_SEND_BLOCK       1   /*wait up to timeoutMs for room*/
+#define ISC_SEND_DROP_OLDEST 2   /*evict the oldest queued messages*/
+
+#define ISC_SEND_WAIT_INFINITE 0xFFFFFFFF
+
+/* Write queue lanes, ISC_SEND_OPTIONS_T priority */
+#define ISC_PRIO_NORMAL      0
+#define ISC_PRIO_HIGH        1   /*control frames, always drained first in strict mode*/
+#define ISC_PRIO_BULK        2
+/* ring slots of a lane out of queueCapacity: ISC_PRIO_NORMAL half of them,
+ * the others a quarter each */
+#define ISC_LANE_CAPACITY(capacity, lane) \
+    (((lane) == ISC_PRIO_NORMAL) ? (capacity) / 2 : (capacity) / 4)
+#define ISC_PRIO_LANES       3
+
+/* How the read task learns that the peer posted data */
+#define ISC_READY_POLL   0   /*wake every pollIntervalUs and try to read*/
+#define ISC_READY_NOTIFY 1   /*backend calls IscNotifyReadable*/
+#define ISC_READY_FD     2   /*backend registers a readable fd (eventfd) with IscSetReadyFd*/
+
+/* IscSetMsgTrace: state at start-up, the build may turn it on */
+#ifndef ISC_MSG_TRACE_DEFAULT
+#define ISC_MSG_TRACE_DEFAULT 0
+#endif
 /* --------------------------------------------------------------------------*/
 /**
 * @brief
@@ -26,40 +96,191 @@ typedef struct Message
     uint16 length;
 }ISC_WRITE_MSG_T;
 
+#define ISC_RECV_BATCH_MAX   64   /*messages per batch receive callback at most*/
+
 /* --------------------------------------------------------------------------*/
 /**
- * @brief  Message Queue Type Definition
+ * @brief  one received message handed to an IscReceivedMsgBatch callback
  */
 /* ----------------------------------------------------------------------------*/
-typedef struct MsgQueueEntryTag
+typedef struct
 {
-    struct MsgQueueEntryTag *next;
-    void * message;
-    uint16 event;
-}IscMsgQueueEntry;
+    uint8* message;
+    uint16 length;
+}ISC_READ_MSG_T;
 
+/* batch receive callback, the messages are only valid until it returns */
+typedef void (*IscReceivedMsgBatch)(const ISC_READ_MSG_T* msgs, uint16 count);
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  per channel tuning, indexed like ChannelMatrix
+ */
+/* ----------------------------------------------------------------------------*/
+typedef struct
+{
+    uint32 queueCapacity;    /*write ring slots of all lanes together, split
+                               by ISC_LANE_CAPACITY, each lane rounded up
+                               to a power of two*/
+    uint32 queueBytes;       /*max payload bytes queued, 0: no byte limit*/
+    uint16 batchBytes;       /*0: one IscWrite per message, else max framed batch size.
+                               on a read entry: peer sends framed batches*/
+    uint16 batchLingerMs;    /*how long a partial batch may wait for more messages*/
+    uint8 readyMode;         /*read entry: ISC_READY_xxx*/
+    uint32 pollIntervalUs;   /*read entry: poll period, also the fallback
+                               while no ready fd is registered*/
+    uint8 laneWeight[ISC_PRIO_LANES]; /*write entry, indexed by ISC_PRIO_xxx:
+                               all 0 drains the lanes by strict priority, else
+                               weighted round robin, messages per turn*/
+    uint16 threadPriority;   /*task thread: ISC_THREAD_PRIORITY_NORMAL or
+                               1..99 for SCHED_FIFO*/
+    uint32 cpuMask;          /*task thread: CPUs it may run on, 0 for all*/
+}ISC_CHANNEL_CONFIG_T;
 
 typedef struct
 {
     uint8 id;
     IscMutexHandle  mMutex;
     void* instanceData;
-    IscMsgQueueEntry* mQueueFirst;
-    IscMsgQueueEntry* mQueueLast;
+    IscMsgRing mQueue[ISC_PRIO_LANES]; /*write queue lanes, producers -> write task*/
+    uint32 queuedBytes;      /*payload bytes in all lanes*/
+    uint8 laneCursor;        /*weighted round robin: lane being served*/
+    uint8 laneCredit;        /*messages it may still send this turn*/
+    uint32 spaceWaiters;     /*senders blocked on a full queue*/
+    IscEventHandle spaceHandle;
+    uint8* batchBuf;         /*coalesce buffer when batching is on*/
+    uint8* retryMsg;         /*head of line write the peer had no room for*/
+    uint16 retryLen;
+    uint16 retryFrames;      /*messages in retryMsg, more than one for a batch*/
+    uint64_t retryStampNs;   /*enqueue time of the oldest message in retryMsg*/
+    uint8 retryCount;        /*attempts of retryMsg so far*/
+    uint32 retrySeed;        /*backoff jitter*/
+    uint64_t retryAtNs;      /*next attempt of retryMsg*/
+    uint8* heldMsg;          /*popped while a batch was held, written next*/
+    uint16 heldLen;
+    uint64_t heldStampNs;
+    uint8 writerIdle;        /*ISC_WRITER_xxx, the next sender wakes a parked writer*/
+    uint8 txWanted;          /*a write is held, IscNotifyWritable wakes the writer*/
+    int readyFd;             /*backend data-ready fd, -1 if none*/
+    int wakeFd;              /*eventfd kicked with the event, -1 if none*/
+    uint8 wakePending;       /*wakeFd written and not yet consumed*/
     IscEventHandle handle;
     IscThreadHandle mThreadHandle;
     uint8 running;           /*sched running flag*/
+    uint8 joinable;          /*mThreadHandle is a thread to join on deinit*/
+    uint8 inReactor;         /*served by a reactor loop, no thread of its own*/
+    uint8 closing;           /*deinit started, senders must not queue or wait*/
+    IscEventHandle doneHandle; /*read entry: ISC_DONE_EVENT once the task loop returned*/
+    uint64_t drainUntilNs;   /*write entry: flush the queue on exit until then, 0 discards*/
 }IscThreadEntry;
 
+typedef struct
+{
+    uint8 mode;              /*ISC_SEND_xxx*/
+    uint32 timeoutMs;        /*ISC_SEND_BLOCK: 0 behaves like nonblock*/
+    uint8 priority;          /*ISC_PRIO_xxx lane*/
+}ISC_SEND_OPTIONS_T;
+
+typedef struct
+{
+    uint32 depth;            /*messages waiting in the lane*/
+    uint32 highWater;        /*max depth seen*/
+    uint32 sent;             /*messages taken by the write task*/
+    uint32 waitAvgUs;        /*mean time from enqueue until taken*/
+    uint32 waitMaxUs;
+}ISC_LANE_STATS_T;
+
+typedef struct
+{
+    uint32 queued;           /*messages in the write queue*/
+    uint32 queuedBytes;
+    uint32 rejected;         /*queue full, the sender did not wait*/
+    uint32 timedOut;         /*queue still full when the send timeout expired*/
+    uint32 evicted;          /*oldest messages dropped for newer ones*/
+    uint32 discarded;        /*dropped by the write task on error or exit*/
+    ISC_LANE_STATS_T lane[ISC_PRIO_LANES];
+}ISC_QUEUE_STATS_T;
+
 void IscexitThread(IscThreadEntry *task);
+void IscTaskWake(IscThreadEntry *task, uint32 eventBits);
+void IscNotifyReadable(uint8 id);
+void IscNotifyWritable(uint8 id);
+/*ISC_READY_FD: one fd per id, ISC_ERR_EXISTS until -1 cleared the previous*/
+uint8 IscSetReadyFd(uint8 id, int fd);
+/*backend: make a read of a channel above ISC_MAX_NORMAL_CHANNEL that is
+  blocked in IscRead/IscSRead return, so deinit can join its reader*/
+typedef void (*IscReadUnblock)(uint32 channel);
+void IscSetReadUnblock(IscReadUnblock fn);
+uint8 IscUnblockRead(uint32 channel);
 int16_t IscThreadInit(uint8 id, uint8 task);
+/*IscThreadDeinitEx with ISC_DEINIT_DRAIN_MS: what the peer does not take
+  within that time is discarded*/
 int16_t IscThreadDeinit(uint8 id);
+/*stop both tasks of id and free them, the writer first flushes its queue
+  for up to drainMs (0 discards it). Not from a callback or task of id,
+  nor from a dispatch worker.
+  ISC_ERR_TIMEOUT if a reader stays blocked
+  in the driver, it is then kept and a later call finishes the job*/
+int16_t IscThreadDeinitEx(uint8 id, uint32 drainMs);
 IscThreadEntry* IscGetTaskEntry(uint8 id, uint8 task);
 IscThreadEntry* IscAllocTaskEntry(uint8 id, uint8 task);
+void IscTaskEntryFree(IscThreadEntry* entry, uint8 taskType);
+/*forget the callbacks, queue counters and last write result of an id
+  without tasks, for IscChannelRemove*/
+void IscThreadResetId(uint8 id);
 void IscAsyncReadTaskLoop(void* data);
 
 void IscAsyncWriteTaskLoop(void* data);
 
+/*loop bodies, shared by the task threads and the reactor*/
+uint8 IscReadDrain(IscThreadEntry* task, uint32 channel, uint16 budget);
+uint32 IscWriteDrain(IscThreadEntry* task, uint32 channel, uint8 linger);
+void IscWriteDiscard(IscThreadEntry* task);
+void IscWriteFlush(IscThreadEntry* task, uint32 channel);
+uint8 IscWriterPark(IscThreadEntry* task, uint8 how);
+uint8 IscWriterHasWork(IscThreadEntry* task);
+/*run the receive callback of id on buf, for the dispatch workers*/
+void IscReceiveDeliver(uint8 id, IscBuffer* buf);
+
+/*pin the tasks of id against IscThreadDeinit while they are used*/
+IscThreadEntry* IscTaskAcquire(uint8 id, uint8 task);
+void IscTaskRelease(uint8 id);
+void IscTaskWaitUnused(uint8 id, IscThreadEntry* writer);
+
+/*zero copy send: build the message in place, then commit or cancel it.
+  On ISC_MIX_ID every message carries the mix_id byte, 0 for none*/
+uint8* IscSendReserve(uint8 id, uint8 mix_id, uint16 length);
+uint8 IscSendCommit(uint8 id, uint8 mix_id, uint8* buf, uint16 length);
+void IscSendCancel(uint8 id, uint8 mix_id, uint8* buf);
+uint8 IscSendCommitEx(uint8 id, uint8 mix_id, uint8* buf, uint16 length, \
+                      const ISC_SEND_OPTIONS_T* opt);
+
+/*IscSendMessage with a full-queue policy, NULL opt: ISC_SEND_NONBLOCK*/
+uint8 IscSendMessageEx(uint8 id, uint8 mix_id, uint8* message, uint16 length, \
+                       const ISC_SEND_OPTIONS_T* opt);
+uint8 IscGetQueueStats(uint8 id, ISC_QUEUE_STATS_T* stats);
+/*send the partial batch of id now instead of waiting out batchLingerMs*/
+uint8 IscSendFlush(uint8 id);
+
+/*zero copy receive on id: every message is loaned to cb as an IscBuffer,
+  valid past the callback while retained. Takes precedence over the
+  IscRegisterCb callback, the batch callback over both*/
+uint8 IscRegisterBufCb(uint8 id, IscReceivedBuf cb);
+uint8 IscUnRegisterBufCb(uint8 id);
+
+/*opt in to batch receive on id: the read task drains up to maxMsgs messages
+  (at most ISC_RECV_BATCH_MAX) or maxBytes payload bytes (0: no limit) and
+  hands them to cb in one call, instead of the IscRegisterCb callback*/
+uint8 IscRegisterBatchCb(uint8 id, IscReceivedMsgBatch cb, uint16 maxMsgs, uint32 maxBytes);
+uint8 IscUnRegisterBatchCb(uint8 id);
+
+/*per message trace on or off: when on, every message sent, written and read
+  is recorded in the trace ring (CpuTrace.h). Independent of the ISCLOGx
+  output, which the platform log configuration controls. Compiled out with
+  ISC_NO_MSG_TRACE, IscGetMsgTrace then stays 0*/
+void IscSetMsgTrace(uint8 enable);
+uint8 IscGetMsgTrace(void);
+
 #ifdef  __cplusplus
 }
 #endif
@@ -0,0 +1,292 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "CpuExt.h"
+#include "private.h"
+#include "CpuThread.h"
+#include "CpuTrace.h"
+
+#define ISC_TRACE_FREE          0
+#define ISC_TRACE_OWNED         1
+#define ISC_TRACE_ORPHAN        2   /*owner exited, drained then freed*/
+
+#define ISC_TRACE_EXIT_EVENT    0x00000001
+
+/* "[0xAB,...]" of ISC_TRACE_DATA_BYTES bytes */
+#define ISC_TRACE_HEX_SIZE      (ISC_TRACE_DATA_BYTES * 5 + 3)
+
+static IscTraceRing *traceRing[ISC_TRACE_MAX_RINGS];
+static uint32 traceLost = 0;        /*records of threads that got no ring*/
+static IscMutexHandle traceMutex;
+static IscEventHandle traceEvent;
+static uint8 traceRunning = 0;     /*0 idle, 1 running, 2 stopping*/
+static IscThreadHandle traceThread;
+static uint16 tracePeriodMs = ISC_TRACE_DRAIN_MS;
+static pthread_once_t traceOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t traceKey;
+
+static __thread IscTraceRing *traceMine = NULL;
+static __thread uint8 traceNoRing = 0;
+
+static const char *const traceDirName[] = {"send", "write", "read"};
+
+typedef char IscTraceRingCheck[((ISC_TRACE_RING_SIZE & (ISC_TRACE_RING_SIZE - 1)) == 0) ? 1 : -1];
+
+/* thread exit: leave the ring to the drainer, it frees it once empty */
+static void IscTraceThreadExit(void *data)
+{
+    IscTraceRing *ring = (IscTraceRing *) data;
+
+    __atomic_store_n(&(ring->state), ISC_TRACE_ORPHAN, __ATOMIC_RELEASE);
+}
+
+static void IscTraceInitOnce(void)
+{
+    (void) IscMutexCreate(&traceMutex);
+    (void) IscEventCreate(&traceEvent);
+    (void) pthread_key_create(&traceKey, IscTraceThreadExit);
+}
+
+static IscTraceRing *IscTraceClaim(void)
+{
+    uint32 i;
+
+    (void) pthread_once(&traceOnce, IscTraceInitOnce);
+
+    for (i = 0; i < ISC_TRACE_MAX_RINGS; i++) {
+        IscTraceRing *ring = __atomic_load_n(&(traceRing[i]), __ATOMIC_ACQUIRE);
+        uint8 state = ISC_TRACE_FREE;
+
+        if (ring == NULL) {
+            IscTraceRing *expected = NULL;
+
+            ring = (IscTraceRing *) IscMalloc(sizeof(IscTraceRing));
+            if (ring == NULL) {
+                return NULL;
+            }
+            memset(ring, 0, sizeof(IscTraceRing));
+            ring->state = ISC_TRACE_OWNED;
+            if (__atomic_compare_exchange_n(&(traceRing[i]), &expected, ring, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                return ring;
+            }
+            IscFree(ring);
+            ring = expected;
+        }
+        if (__atomic_compare_exchange_n(&(ring->state), &state, ISC_TRACE_OWNED, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return ring;
+        }
+    }
+    return NULL;
+}
+
+static void IscTraceHex(char *out, const uint8 *in, uint16 len)
+{
+    static const char hexDigit[] = "0123456789ABCDEF";
+    uint16 i;
+
+    *out++ = '[';
+    if (len == 0) {
+        *out++ = ' ';
+    }
+    for (i = 0; i < len; i++) {
+        *out++ = '0';
+        *out++ = 'x';
+        *out++ = hexDigit[in[i] >> 4];
+        *out++ = hexDigit[in[i] & 0x0F];
+        *out++ = ',';
+    }
+    *out++ = ']';
+    *out = '\0';
+}
+
+static uint32 IscTraceDrain(IscTraceRing *ring)
+{
+    uint8 state = __atomic_load_n(&(ring->state), __ATOMIC_ACQUIRE);
+    uint32 tail = ring->tail;
+    uint32 head = __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE);
+    uint32 dropped = __atomic_exchange_n(&(ring->dropped), 0, __ATOMIC_RELAXED);
+    uint32 count = head - tail;
+    char hex[ISC_TRACE_HEX_SIZE];
+
+    if (dropped != 0) {
+        ISCLOGI("trace: %u records dropped, ring full", dropped);
+    }
+
+    for (; tail != head; tail++) {
+        const IscTraceRecord *rec = &(ring->rec[tail & (ISC_TRACE_RING_SIZE - 1)]);
+        uint16 n = (rec->length > ISC_TRACE_DATA_BYTES) ? ISC_TRACE_DATA_BYTES : rec->length;
+
+        IscTraceHex(hex, rec->data, n);
+        ISCLOGT("trace %llu.%09llu id %d %s length %d,%s",
+                (unsigned long long) (rec->timeNs / 1000000000ULL),
+                (unsigned long long) (rec->timeNs % 1000000000ULL),
+                rec->id, (rec->dir <= ISC_TRACE_READ) ? traceDirName[rec->dir] : "?",
+                rec->length, hex);
+    }
+    __atomic_store_n(&(ring->tail), tail, __ATOMIC_RELEASE);
+
+    /* the owner is gone and nothing can follow, hand the ring out again */
+    if (state == ISC_TRACE_ORPHAN) {
+        __atomic_store_n(&(ring->state), ISC_TRACE_FREE, __ATOMIC_RELEASE);
+    }
+    return count;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscTraceMessage
+ *
+ *  DESCRIPTION
+ *      Store a record of the message in the calling thread's trace ring.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscTraceMessage(uint8 id, uint8 dir, const void *msg, uint16 len)
+{
+    IscTraceRing *ring = traceMine;
+    IscTraceRecord *rec;
+    uint32 head;
+
+    if (ring == NULL) {
+        if (traceNoRing) {
+            __atomic_fetch_add(&traceLost, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        ring = IscTraceClaim();
+        if (ring == NULL) {
+            traceNoRing = 1;
+            __atomic_fetch_add(&traceLost, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        traceMine = ring;
+        (void) pthread_setspecific(traceKey, ring);
+    }
+
+    head = ring->head;
+    if (head - __atomic_load_n(&(ring->tail), __ATOMIC_ACQUIRE) >= ISC_TRACE_RING_SIZE) {
+        __atomic_fetch_add(&(ring->dropped), 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    rec = &(ring->rec[head & (ISC_TRACE_RING_SIZE - 1)]);
+    rec->timeNs = IscTimeNowNs();
+    rec->id = id;
+    rec->dir = dir;
+    rec->length = len;
+    if (msg != NULL) {
+        memcpy(rec->data, msg, (len > ISC_TRACE_DATA_BYTES) ? ISC_TRACE_DATA_BYTES : len);
+    }
+    else {
+        rec->length = 0;
+    }
+    __atomic_store_n(&(ring->head), head + 1, __ATOMIC_RELEASE);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscTraceDump
+ *
+ *  DESCRIPTION
+ *      Format all pending records of all threads into the trace log.
+ *
+ *  RETURNS
+ *      number of records written
+ *----------------------------------------------------------------------------*/
+uint32 IscTraceDump(void)
+{
+    uint32 count = 0;
+    uint32 lost;
+    uint32 i;
+
+    (void) pthread_once(&traceOnce, IscTraceInitOnce);
+
+    IscMutexLock(&traceMutex);
+    for (i = 0; i < ISC_TRACE_MAX_RINGS; i++) {
+        IscTraceRing *ring = __atomic_load_n(&(traceRing[i]), __ATOMIC_ACQUIRE);
+
+        if ((ring != NULL) &&
+            (__atomic_load_n(&(ring->state), __ATOMIC_ACQUIRE) != ISC_TRACE_FREE)) {
+            count += IscTraceDrain(ring);
+        }
+    }
+    lost = __atomic_exchange_n(&traceLost, 0, __ATOMIC_RELAXED);
+    IscMutexUnlock(&traceMutex);
+
+    if (lost != 0) {
+        ISCLOGI("trace: %u records lost, more than %d tracing threads",
+                lost, ISC_TRACE_MAX_RINGS);
+    }
+    return count;
+}
+
+static void IscTraceRun(void *data)
+{
+    uint32 eventBits = 0;
+
+    (void) data;
+    do {
+        (void) IscEventWait(&traceEvent, tracePeriodMs, &eventBits);
+        (void) IscTraceDump();
+    } while ((eventBits & ISC_TRACE_EXIT_EVENT) == 0);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscTraceStart
+ *
+ *  DESCRIPTION
+ *      Start the background drainer thread.
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_NO_MORE_THREADS  in case the thread cannot be started
+ *          ISC_RESULT_FAILURE          in case the drainer runs already
+ *----------------------------------------------------------------------------*/
+IscResult IscTraceStart(uint16 periodMs)
+{
+    uint8 running = 0;
+
+    (void) pthread_once(&traceOnce, IscTraceInitOnce);
+
+    if (!__atomic_compare_exchange_n(&traceRunning, &running, 1, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        return ISC_RESULT_FAILURE;
+    }
+    tracePeriodMs = (periodMs != 0) ? periodMs : ISC_TRACE_DRAIN_MS;
+
+    if (IscThreadCreateEx(IscTraceRun, NULL, ISC_DEFAULT_STACK_SIZE, 0, 0,
+                          "IscTrace", &traceThread) != ISC_RESULT_SUCCESS) {
+        __atomic_store_n(&traceRunning, 0, __ATOMIC_RELEASE);
+        return ISC_RESULT_NO_MORE_THREADS;
+    }
+    return ISC_RESULT_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscTraceStop
+ *
+ *  DESCRIPTION
+ *      Ask the drainer thread to dump what is left and exit, and join it,
+ *      so IscTraceStart may be called again right away.
+ *
+ *  RETURNS
+ *      void
+ *----------------------------------------------------------------------------*/
+void IscTraceStop(void)
+{
+    uint8 running = 1;
+
+    if (!__atomic_compare_exchange_n(&traceRunning, &running, 2, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        return;
+    }
+    (void) IscEventSet(&traceEvent, ISC_TRACE_EXIT_EVENT);
+    (void) IscThreadJoin(&traceThread);
+    __atomic_store_n(&traceRunning, 0, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,119 @@
+#ifndef __CPU_TRACE_H__
+#define __CPU_TRACE_H__
+
+#include "types.h"
+#include "CpuExt.h"
+#include "CpuRing.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#define ISC_TRACE_DATA_BYTES    20      /*message bytes kept per record*/
+#define ISC_TRACE_RING_SIZE     512     /*records per thread, power of 2*/
+#define ISC_TRACE_MAX_RINGS     32      /*threads that can trace at once*/
+#define ISC_TRACE_DRAIN_MS      100     /*default period of the drainer thread*/
+
+/* Record directions */
+#define ISC_TRACE_SEND          0       /*queued by IscSendMessage*/
+#define ISC_TRACE_WRITE         1       /*handed to the backend by the write task*/
+#define ISC_TRACE_READ          2       /*read from the backend, before the callback*/
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  one trace record, 32 bytes, stored unformatted
+ */
+/* ----------------------------------------------------------------------------*/
+typedef struct
+{
+    uint64_t timeNs;         /*IscTimeNowNs at record time*/
+    uint8 id;
+    uint8 dir;
+    uint16 length;           /*full message length, data holds the head*/
+    uint8 data[ISC_TRACE_DATA_BYTES];
+}IscTraceRecord;
+
+/* --------------------------------------------------------------------------*/
+/**
+ * @brief  single-producer/single-consumer ring owned by one thread
+ */
+/* ----------------------------------------------------------------------------*/
+typedef struct
+{
+    uint32 head;             /*next record written by the owner*/
+    uint8 pad0[ISC_CACHE_LINE_SIZE - sizeof(uint32)];
+    uint32 tail;             /*next record formatted by the drainer*/
+    uint32 dropped;          /*records lost because the ring was full*/
+    uint8 state;             /*free, owned or orphaned by an exited thread*/
+    uint8 pad1[ISC_CACHE_LINE_SIZE - 2 * sizeof(uint32) - sizeof(uint8)];
+    IscTraceRecord rec[ISC_TRACE_RING_SIZE];
+}IscTraceRing;
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscTraceMessage
+ *
+ *  DESCRIPTION
+ *      Store a record of the message in the calling thread's trace ring.
+ *      Copies at most ISC_TRACE_DATA_BYTES, takes no lock and does no
+ *      formatting. When the ring is full the record is dropped and counted.
+ *
+ *  RETURNS
+ *      void
+ *
+ *----------------------------------------------------------------------------*/
+
+void IscTraceMessage(uint8 id, uint8 dir, const void *msg, uint16 len);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscTraceDump
+ *
+ *  DESCRIPTION
+ *      Format all pending records of all threads into the trace log.
+ *      Serialised internally, may be called from any thread.
+ *
+ *  RETURNS
+ *      number of records written
+ *
+ *----------------------------------------------------------------------------*/
+
+uint32 IscTraceDump(void);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscTraceStart
+ *
+ *  DESCRIPTION
+ *      Start a background thread calling IscTraceDump every periodMs
+ *      (ISC_TRACE_DRAIN_MS if 0).
+ *
+ *  RETURNS
+ *      Possible values:
+ *          ISC_RESULT_SUCCESS          in case of success
+ *          ISC_RESULT_NO_MORE_THREADS  in case the thread cannot be started
+ *          ISC_RESULT_FAILURE          in case the drainer runs already
+ *
+ *----------------------------------------------------------------------------*/
+
+IscResult IscTraceStart(uint16 periodMs);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      IscTraceStop
+ *
+ *  DESCRIPTION
+ *      Ask the drainer thread to dump what is left and exit, and wait
+ *      for it, so IscTraceStart may be called again right away.
+ *
+ *  RETURNS
+ *      void
+ *
+ *----------------------------------------------------------------------------*/
+
+void IscTraceStop(void);
+
+#ifdef  __cplusplus
+}
+#endif
+#endif